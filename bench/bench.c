@@ -0,0 +1,605 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_irq.h>
+#include <simavr/avr_ioport.h>
+
+// Cycle benchmark, runs the firmware ELF under simavr with a
+//   fixed encoder script and reports a TSV table of cycles for
+//   each hot path, the script never changes so the numbers can
+//   be compared between commits
+//   bench [-a] [-n avr-nm] [-S pin] firmware.elf
+//   -a => Report every function, not just the hot paths
+//   -n => nm to read the symbol table with
+//   -S => Step output pin, C0 (A0) or B1 (D9, OC1A output)
+
+#define F_CPU 16000000UL
+#define CYCLES_PER_MS (F_CPU / 1000UL)
+
+// Flash size in bytes, the symbol lookup is indexed by word
+#define FLASH_SIZE 0x8000
+
+#define MAX_SYMBOLS 512
+#define MAX_FRAMES 64
+#define MAX_EVENTS 8192
+#define MAX_WAITING 1024
+
+// Encoder on D2/D3, buttons on D4-D6
+#define ENCODER_PORT 'D'
+#define ENCODER_A_BIT 2
+#define ENCODER_B_BIT 3
+#define ZERO_BIT 4
+#define COARSE_BIT 5
+#define FINE_BIT 6
+
+typedef struct
+{
+	char name[64];
+	uint32_t addr;
+	uint8_t report;
+	uint32_t calls;
+	uint64_t min;
+	uint64_t max;
+	uint64_t total;
+} symbol_t;
+
+typedef struct
+{
+	uint16_t symbol;
+	uint16_t sp;
+	uint64_t cycle;
+} frame_t;
+
+typedef struct
+{
+	uint64_t cycle;
+	uint8_t bit;
+	uint8_t level;
+	// Set on the edge that completes a detent
+	uint8_t detent;
+} event_t;
+
+typedef struct
+{
+	const char *name;
+	uint32_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t total;
+} latency_t;
+
+// Hot paths always in the table, static functions may be
+//   inlined by LTO and show up with no calls
+static const char *const hot_paths[] =
+{
+	"__vector_1",
+	"__vector_2",
+	"__vector_5",
+	"__vector_7",
+	"__vector_11",
+	"__vector_13",
+	"__vector_14",
+	"__vector_17",
+	"__vector_19",
+	"handle_detent",
+	"handle_output",
+	"stepper_move",
+	"gear_convert",
+	"stepper_update",
+	"queue_push",
+	"profile_next",
+	"display_update",
+	"display_refresh",
+	"spi_write",
+};
+
+// Vector names for the table
+static const char *const vector_names[26] =
+{
+	NULL, "INT0_vect", "INT1_vect", "PCINT0_vect", "PCINT1_vect", "PCINT2_vect",
+	"WDT_vect", "TIMER2_COMPA_vect", "TIMER2_COMPB_vect", "TIMER2_OVF_vect",
+	"TIMER1_CAPT_vect", "TIMER1_COMPA_vect", "TIMER1_COMPB_vect", "TIMER1_OVF_vect",
+	"TIMER0_COMPA_vect", "TIMER0_COMPB_vect", "TIMER0_OVF_vect", "SPI_STC_vect",
+	"USART_RX_vect", "USART_UDRE_vect", "USART_TX_vect", "ADC_vect", "EE_READY_vect",
+	"ANALOG_COMP_vect", "TWI_vect", "SPM_READY_vect",
+};
+
+static symbol_t symbols[MAX_SYMBOLS];
+static uint16_t symbol_count = 0;
+// Symbol index + 1 for each function entry point, by word address
+static uint16_t entry[FLASH_SIZE / 2];
+
+static frame_t frames[MAX_FRAMES];
+static uint8_t frame_count = 0;
+
+static event_t events[MAX_EVENTS];
+static uint32_t event_count = 0;
+
+static avr_t *avr = NULL;
+
+// Edge to encoder ISR entry
+static latency_t edge_latency = {"latency_edge_to_isr", 0, UINT64_MAX, 0, 0};
+static uint64_t edge_pending = 0;
+static uint16_t encoder_isr[2] = {0};
+
+// Detent to the next step pulse
+static latency_t step_latency = {"latency_detent_to_step", 0, UINT64_MAX, 0, 0};
+static uint64_t waiting[MAX_WAITING];
+static uint32_t waiting_count = 0;
+static uint32_t steps = 0;
+
+static void add_sample(latency_t *latency, uint64_t cycles)
+{
+	latency->count += 1;
+	latency->total += cycles;
+
+	if (cycles < latency->min)
+	{
+		latency->min = cycles;
+	}
+
+	if (cycles > latency->max)
+	{
+		latency->max = cycles;
+	}
+}
+
+static uint8_t is_hot_path(const char *name)
+{
+	for (size_t i = 0; i < (sizeof(hot_paths) / sizeof(hot_paths[0])); i++)
+	{
+		if (strcmp(name, hot_paths[i]) == 0)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static uint16_t find_symbol(const char *name)
+{
+	for (uint16_t i = 0; i < symbol_count; i++)
+	{
+		if (strcmp(symbols[i].name, name) == 0)
+		{
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+static uint16_t add_symbol(const char *name, uint32_t addr, uint8_t report)
+{
+	uint16_t index = find_symbol(name);
+
+	if (index != 0)
+	{
+		symbols[index - 1].report |= report;
+
+		return index;
+	}
+
+	if (symbol_count >= MAX_SYMBOLS)
+	{
+		return 0;
+	}
+
+	symbol_t *symbol = &symbols[symbol_count];
+
+	snprintf(symbol->name, sizeof(symbol->name), "%s", name);
+	symbol->addr = addr;
+	symbol->report = report;
+	symbol->min = UINT64_MAX;
+	symbol_count += 1;
+
+	return symbol_count;
+}
+
+static void read_symbols(const char *nm, const char *elf, uint8_t all)
+{
+	char command[512];
+	char line[256];
+
+	// Hot paths are listed even when they have no code of their own
+	for (size_t i = 0; i < (sizeof(hot_paths) / sizeof(hot_paths[0])); i++)
+	{
+		add_symbol(hot_paths[i], UINT32_MAX, 1);
+	}
+
+	snprintf(command, sizeof(command), "%s -S --defined-only \"%s\"", nm, elf);
+
+	FILE *pipe = popen(command, "r");
+
+	if (pipe == NULL)
+	{
+		perror(nm);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), pipe) != NULL)
+	{
+		unsigned long addr;
+		unsigned long size;
+		char type;
+		char name[128];
+
+		// address size type name, only functions in flash
+		if (sscanf(line, "%lx %lx %c %127s", &addr, &size, &type, name) != 4)
+		{
+			continue;
+		}
+
+		if (((type != 'T') && (type != 't')) || (addr >= FLASH_SIZE))
+		{
+			continue;
+		}
+
+		// LTO clones keep the original name up to the first dot
+		char *dot = strchr(name, '.');
+
+		if (dot != NULL)
+		{
+			*dot = '\0';
+		}
+
+		uint8_t hot = is_hot_path(name);
+
+		if ((hot == 0) && (all == 0))
+		{
+			continue;
+		}
+
+		uint16_t index = add_symbol(name, addr, 1);
+
+		if (index == 0)
+		{
+			continue;
+		}
+
+		if (symbols[index - 1].addr == UINT32_MAX)
+		{
+			symbols[index - 1].addr = addr;
+		}
+
+		entry[addr / 2] = index;
+	}
+
+	pclose(pipe);
+
+	encoder_isr[0] = find_symbol("__vector_1");
+	encoder_isr[1] = find_symbol("__vector_2");
+}
+
+static uint16_t get_sp(void)
+{
+	return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+static void observe(void)
+{
+	uint16_t sp = get_sp();
+
+	// Frames return when the stack pointer climbs above where
+	//   it was on entry, nested frames always sit below
+	while ((frame_count != 0) && (sp > frames[frame_count - 1].sp))
+	{
+		frame_t *frame = &frames[--frame_count];
+		symbol_t *symbol = &symbols[frame->symbol - 1];
+		uint64_t cycles = avr->cycle - frame->cycle;
+
+		symbol->calls += 1;
+		symbol->total += cycles;
+
+		if (cycles < symbol->min)
+		{
+			symbol->min = cycles;
+		}
+
+		if (cycles > symbol->max)
+		{
+			symbol->max = cycles;
+		}
+	}
+
+	if (avr->pc >= FLASH_SIZE)
+	{
+		return;
+	}
+
+	uint16_t index = entry[avr->pc / 2];
+
+	if (index == 0)
+	{
+		return;
+	}
+
+	// First edge after the last encoder ISR
+	if ((edge_pending != 0) && ((index == encoder_isr[0]) || (index == encoder_isr[1])))
+	{
+		add_sample(&edge_latency, avr->cycle - edge_pending);
+		edge_pending = 0;
+	}
+
+	if (frame_count < MAX_FRAMES)
+	{
+		frames[frame_count].symbol = index;
+		frames[frame_count].sp = sp;
+		frames[frame_count].cycle = avr->cycle;
+		frame_count += 1;
+	}
+}
+
+static void step_notify(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq;
+	(void)param;
+
+	// Rising edges only
+	if (value == 0)
+	{
+		return;
+	}
+
+	steps += 1;
+
+	for (uint32_t i = 0; i < waiting_count; i++)
+	{
+		add_sample(&step_latency, avr->cycle - waiting[i]);
+	}
+
+	waiting_count = 0;
+}
+
+static void add_event(uint64_t cycle, uint8_t bit, uint8_t level, uint8_t detent)
+{
+	if (event_count >= MAX_EVENTS)
+	{
+		fprintf(stderr, "bench: script too long\n");
+		exit(1);
+	}
+
+	events[event_count].cycle = cycle;
+	events[event_count].bit = bit;
+	events[event_count].level = level;
+	events[event_count].detent = detent;
+	event_count += 1;
+}
+
+static uint64_t add_detents(uint64_t at, int32_t count, uint32_t rate)
+{
+	// Pin levels for each quarter of a detent turning positive,
+	//   negative runs the same states with A and B swapped
+	static const uint8_t quadrature[4][2] = {{1, 0}, {0, 0}, {0, 1}, {1, 1}};
+	uint64_t quarter = F_CPU / rate / 4;
+	uint8_t reverse = count < 0;
+
+	for (int32_t i = 0; i < abs(count); i++)
+	{
+		for (uint8_t q = 0; q < 4; q++)
+		{
+			uint8_t a = quadrature[q][reverse ? 1 : 0];
+			uint8_t b = quadrature[q][reverse ? 0 : 1];
+
+			at += quarter;
+			// Only one pin changes each quarter
+			add_event(at, ENCODER_A_BIT, a, 0);
+			add_event(at, ENCODER_B_BIT, b, q == 3);
+		}
+	}
+
+	return at;
+}
+
+static uint64_t add_press(uint64_t at, uint8_t bit)
+{
+	// Held well past the debounce time, short of a long press
+	add_event(at, bit, 0, 0);
+	at += 200 * CYCLES_PER_MS;
+	add_event(at, bit, 1, 0);
+
+	return at + (50 * CYCLES_PER_MS);
+}
+
+static uint64_t build_script(void)
+{
+	// Let the firmware finish starting up
+	uint64_t at = 200 * CYCLES_PER_MS;
+
+	// Slow turn, fast spin, reverse, then coarse steps
+	at = add_detents(at, 20, 50);
+	at += 100 * CYCLES_PER_MS;
+	at = add_detents(at, 200, 1000);
+	at += 100 * CYCLES_PER_MS;
+	at = add_detents(at, -100, 500);
+	at += 100 * CYCLES_PER_MS;
+	at = add_press(at, COARSE_BIT);
+	at = add_detents(at, 50, 200);
+	at += 100 * CYCLES_PER_MS;
+	at = add_press(at, FINE_BIT);
+
+	// Let the step output drain
+	return at + (200 * CYCLES_PER_MS);
+}
+
+static void print_row(const char *name, uint32_t count, uint64_t min, uint64_t max, uint64_t total)
+{
+	if (count == 0)
+	{
+		printf("%s\t0\t-\t-\t-\t-\n", name);
+
+		return;
+	}
+
+	printf("%s\t%u\t%llu\t%llu\t%llu\t%llu\n", name, count, (unsigned long long)min,
+		(unsigned long long)(total / count), (unsigned long long)max, (unsigned long long)total);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-a] [-n avr-nm] [-S C0|B1] firmware.elf\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *nm = "avr-nm";
+	char step_port = 'C';
+	uint8_t step_bit = 0;
+	uint8_t all = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "an:S:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a': all = 1; break;
+			case 'n': nm = optarg; break;
+
+			case 'S':
+			{
+				if ((strlen(optarg) != 2) || (optarg[0] < 'B') || (optarg[0] > 'D') ||
+					(optarg[1] < '0') || (optarg[1] > '7'))
+				{
+					usage(argv[0]);
+				}
+
+				step_port = optarg[0];
+				step_bit = optarg[1] - '0';
+
+				break;
+			}
+
+			default:
+			{
+				usage(argv[0]);
+			}
+		}
+	}
+
+	if (optind != (argc - 1))
+	{
+		usage(argv[0]);
+	}
+
+	const char *elf = argv[optind];
+	elf_firmware_t firmware;
+
+	memset(&firmware, 0, sizeof(firmware));
+
+	if (elf_read_firmware(elf, &firmware) != 0)
+	{
+		fprintf(stderr, "bench: can't read %s\n", elf);
+		return 1;
+	}
+
+	// The ELF has no .mmcu section, fill in the part
+	if (firmware.mmcu[0] == '\0')
+	{
+		strcpy(firmware.mmcu, "atmega328p");
+	}
+
+	if (firmware.frequency == 0)
+	{
+		firmware.frequency = F_CPU;
+	}
+
+	avr = avr_make_mcu_by_name(firmware.mmcu);
+
+	if (avr == NULL)
+	{
+		fprintf(stderr, "bench: unknown part %s\n", firmware.mmcu);
+		return 1;
+	}
+
+	avr_init(avr);
+	avr_load_firmware(avr, &firmware);
+
+	read_symbols(nm, elf, all);
+
+	avr_irq_t *encoder_a = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ENCODER_PORT), ENCODER_A_BIT);
+	avr_irq_t *encoder_b = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ENCODER_PORT), ENCODER_B_BIT);
+	avr_irq_t *step = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(step_port), step_bit);
+
+	avr_irq_register_notify(step, step_notify, NULL);
+
+	// Encoder resting on a detent, buttons released
+	avr_raise_irq(encoder_a, 1);
+	avr_raise_irq(encoder_b, 1);
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ENCODER_PORT), ZERO_BIT), 1);
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ENCODER_PORT), COARSE_BIT), 1);
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ENCODER_PORT), FINE_BIT), 1);
+
+	uint64_t end = build_script();
+	uint32_t next = 0;
+
+	while (avr->cycle < end)
+	{
+		// Apply every input change that is due
+		while ((next < event_count) && (events[next].cycle <= avr->cycle))
+		{
+			event_t *event = &events[next++];
+			avr_irq_t *irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ENCODER_PORT), event->bit);
+
+			// Only count edges that actually change an encoder pin
+			if ((irq->value != event->level) && ((event->bit == ENCODER_A_BIT) || (event->bit == ENCODER_B_BIT)))
+			{
+				if (edge_pending == 0)
+				{
+					edge_pending = avr->cycle;
+				}
+			}
+
+			avr_raise_irq(irq, event->level);
+
+			if ((event->detent != 0) && (waiting_count < MAX_WAITING))
+			{
+				waiting[waiting_count++] = avr->cycle;
+			}
+		}
+
+		int state = avr_run(avr);
+
+		if ((state == cpu_Done) || (state == cpu_Crashed))
+		{
+			fprintf(stderr, "bench: cpu stopped at pc 0x%04x\n", (unsigned)avr->pc);
+			return 1;
+		}
+
+		observe();
+	}
+
+	printf("name\tcalls\tmin\tavg\tmax\ttotal\n");
+
+	for (uint16_t i = 0; i < symbol_count; i++)
+	{
+		const char *name = symbols[i].name;
+		int vector;
+
+		if (symbols[i].report == 0)
+		{
+			continue;
+		}
+
+		// Show vectors by name
+		if ((sscanf(name, "__vector_%d", &vector) == 1) && (vector > 0) && (vector < 26))
+		{
+			name = vector_names[vector];
+		}
+
+		print_row(name, symbols[i].calls, symbols[i].min, symbols[i].max, symbols[i].total);
+	}
+
+	print_row(edge_latency.name, edge_latency.count, edge_latency.min, edge_latency.max, edge_latency.total);
+	print_row(step_latency.name, step_latency.count, step_latency.min, step_latency.max, step_latency.total);
+	printf("steps\t%u\t-\t-\t-\t-\n", steps);
+
+	return 0;
+}
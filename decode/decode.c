@@ -0,0 +1,296 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <termios.h>
+
+#include "telemetry.h"
+
+// Telemetry decoder, turns the firmware's binary telemetry
+//   stream into CSV on stdout, one line per sample
+//   decode [-b baud] [file]
+//   file => Capture file, serial port or pty, stdin if left out
+//   -b => Baud rate when reading a serial port, 500000 by default,
+//     the UART_BAUD the firmware uses with telemetry on
+//   Text the firmware prints between frames goes to stderr, and
+//   a summary of good, bad and lost frames is printed at the end
+//   The sample is copied straight into telemetry_sample_t,
+//   which only works because x86 is little endian like the AVR
+
+// Longest run of bytes between delimiters kept, anything
+//   longer can't be a frame and is only passed on as text
+#define MAX_CHUNK 256
+
+#define PAYLOAD_SIZE (sizeof(telemetry_sample_t) + TELEMETRY_CRC_SIZE)
+
+static uint8_t chunk[MAX_CHUNK];
+static size_t chunk_length = 0;
+static uint8_t chunk_overflow = 0;
+
+static uint32_t frames = 0;
+static uint32_t bad = 0;
+static uint32_t lost = 0;
+static int16_t last_sequence = -1;
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-b baud] [file]\n", name);
+	exit(1);
+}
+
+static speed_t get_speed(long baud)
+{
+	// termios has no constant for 250000, 1kHz telemetry
+	//   needs 500000 anyway, see telemetry.h
+	switch (baud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 500000: return B500000;
+		case 1000000: return B1000000;
+		default: return B0;
+	}
+}
+
+static size_t decode_cobs(const uint8_t *in, size_t length, uint8_t *out)
+{
+	size_t n = 0;
+	size_t i = 0;
+
+	while (i < length)
+	{
+		uint8_t code = in[i];
+
+		// A zero or a run past the end means it isn't COBS
+		if ((code == 0) || ((i + code) > length))
+		{
+			return 0;
+		}
+
+		i += 1;
+
+		for (uint8_t j = 1; j < code; j++)
+		{
+			if (i >= length)
+			{
+				return 0;
+			}
+
+			out[n++] = in[i++];
+		}
+
+		// Every run but the last ends in a zero
+		if ((code < 0xFF) && (i < length))
+		{
+			out[n++] = 0;
+		}
+	}
+
+	return n;
+}
+
+static void print_text(const uint8_t *data, size_t length)
+{
+	// Only pass on chunks that look like printf() output
+	for (size_t i = 0; i < length; i++)
+	{
+		if (!isprint(data[i]) && !isspace(data[i]))
+		{
+			return;
+		}
+	}
+
+	fwrite(data, 1, length, stderr);
+}
+
+static void handle_chunk(const uint8_t *data, size_t length)
+{
+	uint8_t payload[MAX_CHUNK];
+	telemetry_sample_t s;
+
+	// Back to back delimiters
+	if (length == 0)
+	{
+		return;
+	}
+
+	size_t n = decode_cobs(data, length, payload);
+
+	if (n != PAYLOAD_SIZE)
+	{
+		// Not a frame, most likely text
+		print_text(data, length);
+
+		return;
+	}
+
+	uint16_t crc = payload[sizeof(s)] | ((uint16_t)payload[sizeof(s) + 1] << 8);
+
+	if ((telemetry_crc(0xFFFF, payload, sizeof(s)) != crc) || (payload[0] != TELEMETRY_VERSION))
+	{
+		bad += 1;
+
+		return;
+	}
+
+	memcpy(&s, payload, sizeof(s));
+
+	// Count the samples missing from the sequence
+	if (last_sequence >= 0)
+	{
+		lost += (uint8_t)(s.sequence - last_sequence - 1);
+	}
+
+	last_sequence = s.sequence;
+	frames += 1;
+
+	printf("%u,%u,%d,%d,%u,%u,%u,%u\n", s.sequence, s.time_us, s.position,
+		s.encoder_delta, s.queue_depth, s.step_rate, s.loop_max_us, s.dropped);
+}
+
+static void setup_port(int fd, speed_t speed)
+{
+	struct termios tty;
+
+	if (tcgetattr(fd, &tty) != 0)
+	{
+		perror("tcgetattr");
+		exit(1);
+	}
+
+	// Raw bytes, no echo or line editing
+	cfmakeraw(&tty);
+	cfsetispeed(&tty, speed);
+	cfsetospeed(&tty, speed);
+	tty.c_cc[VMIN] = 1;
+	tty.c_cc[VTIME] = 0;
+
+	if (tcsetattr(fd, TCSANOW, &tty) != 0)
+	{
+		perror("tcsetattr");
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	long baud = 500000;
+	int fd = STDIN_FILENO;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'b': baud = strtol(optarg, NULL, 10); break;
+
+			default:
+			{
+				usage(argv[0]);
+			}
+		}
+	}
+
+	if (optind < (argc - 1))
+	{
+		usage(argv[0]);
+	}
+
+	if (optind == (argc - 1))
+	{
+		fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+
+		if (fd < 0)
+		{
+			perror(argv[optind]);
+			exit(1);
+		}
+	}
+
+	// Serial ports and ptys need to be set to raw
+	if (isatty(fd))
+	{
+		speed_t speed = get_speed(baud);
+
+		if (speed == B0)
+		{
+			fprintf(stderr, "unsupported baud rate %ld\n", baud);
+			exit(1);
+		}
+
+		setup_port(fd, speed);
+	}
+
+	printf("sequence,time_us,position,encoder_delta,queue_depth,step_rate,loop_max_us,dropped\n");
+
+	while (1)
+	{
+		uint8_t buffer[256];
+		ssize_t got = read(fd, buffer, sizeof(buffer));
+
+		if (got < 0)
+		{
+			// A pty reads EIO once the other end closes
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			if (errno != EIO)
+			{
+				perror("read");
+			}
+
+			break;
+		}
+
+		if (got == 0)
+		{
+			break;
+		}
+
+		for (ssize_t i = 0; i < got; i++)
+		{
+			if (buffer[i] != 0)
+			{
+				if (chunk_length < MAX_CHUNK)
+				{
+					chunk[chunk_length++] = buffer[i];
+				}
+				else
+				{
+					chunk_overflow = 1;
+				}
+
+				continue;
+			}
+
+			// Delimiter, the chunk before it is done
+			if (chunk_overflow == 0)
+			{
+				handle_chunk(chunk, chunk_length);
+			}
+
+			chunk_length = 0;
+			chunk_overflow = 0;
+		}
+
+		// Keep the CSV moving when reading a live port
+		fflush(stdout);
+	}
+
+	// Anything after the last delimiter can only be text
+	print_text(chunk, chunk_length);
+
+	fprintf(stderr, "frames: %u, bad: %u, lost: %u\n", frames, bad, lost);
+
+	return 0;
+}
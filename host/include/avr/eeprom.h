@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// EEMEM variables are plain RAM on the host, reads and writes
+//   go straight to them, so saved data only lasts for one run
+//   and starts out zeroed rather than erased to 0xFF
+#define EEMEM
+
+// Writes land straight away, so the EEPROM is never busy
+#define eeprom_is_ready() 1
+
+static inline uint8_t eeprom_read_byte(const uint8_t *src)
+{
+	return *src;
+}
+
+static inline void eeprom_write_byte(uint8_t *dst, uint8_t value)
+{
+	*dst = value;
+}
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, src, n);
+}
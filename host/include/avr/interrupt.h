@@ -0,0 +1,11 @@
+#pragma once
+
+#include <avr/io.h>
+
+// Handlers are plain functions, the simulator calls them
+//   with the I flag cleared like the hardware would
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+// Both go through SREG so pending interrupts are delivered
+#define sei() (SREG |= (1 << SREG_I))
+#define cli() (SREG &= (uint8_t)~(1 << SREG_I))
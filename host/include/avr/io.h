@@ -0,0 +1,292 @@
+#pragma once
+
+// Simulated ATmega328P registers for the host build
+//   Every register access goes through the simulator, which
+//   advances virtual time and delivers interrupts before
+//   handing back the register
+//   Registers with side effects on write (PINx, TIFRx, SPDR...)
+//   are read only to the firmware, it writes them through
+//   REG_WRITE() from reg.h, which hands the value to sim_write()
+//   A plain store to one of them doesn't compile
+
+#include <stdint.h>
+#include <stdio.h>
+
+volatile uint8_t *sim_reg8(uint8_t addr);
+volatile uint16_t *sim_reg16(uint8_t addr);
+const volatile uint8_t *sim_strobe(uint8_t addr);
+void sim_write(const volatile uint8_t *reg, uint8_t value);
+
+#define REG_WRITE(reg, value) sim_write(&(reg), (value))
+
+// Host replacements for things the firmware does in assembly
+//   or through avr-libc
+void sim_sleep(void);
+
+#define _BV(bit) (1 << (bit))
+
+// Data space addresses, same as the real part
+#define PINB (*sim_strobe(0x23))
+#define DDRB (*sim_reg8(0x24))
+#define PORTB (*sim_reg8(0x25))
+#define PINC (*sim_strobe(0x26))
+#define DDRC (*sim_reg8(0x27))
+#define PORTC (*sim_reg8(0x28))
+#define PIND (*sim_strobe(0x29))
+#define DDRD (*sim_reg8(0x2A))
+#define PORTD (*sim_reg8(0x2B))
+
+#define TIFR0 (*sim_strobe(0x35))
+#define TIFR1 (*sim_strobe(0x36))
+#define TIFR2 (*sim_strobe(0x37))
+#define PCIFR (*sim_strobe(0x3B))
+#define EIFR (*sim_strobe(0x3C))
+#define EIMSK (*sim_reg8(0x3D))
+#define GPIOR0 (*sim_reg8(0x3E))
+#define GTCCR (*sim_reg8(0x43))
+#define TCCR0A (*sim_reg8(0x44))
+#define TCCR0B (*sim_reg8(0x45))
+#define TCNT0 (*sim_reg8(0x46))
+#define OCR0A (*sim_reg8(0x47))
+#define OCR0B (*sim_reg8(0x48))
+#define GPIOR1 (*sim_reg8(0x4A))
+#define GPIOR2 (*sim_reg8(0x4B))
+#define SPCR (*sim_reg8(0x4C))
+#define SPSR (*sim_reg8(0x4D))
+#define SPDR (*sim_strobe(0x4E))
+#define SMCR (*sim_reg8(0x53))
+#define MCUSR (*sim_reg8(0x54))
+#define MCUCR (*sim_reg8(0x55))
+#define SREG (*sim_reg8(0x5F))
+
+#define PCICR (*sim_reg8(0x68))
+#define EICRA (*sim_reg8(0x69))
+#define PCMSK0 (*sim_reg8(0x6B))
+#define PCMSK1 (*sim_reg8(0x6C))
+#define PCMSK2 (*sim_reg8(0x6D))
+#define TIMSK0 (*sim_reg8(0x6E))
+#define TIMSK1 (*sim_reg8(0x6F))
+#define TIMSK2 (*sim_reg8(0x70))
+
+#define TCCR1A (*sim_reg8(0x80))
+#define TCCR1B (*sim_reg8(0x81))
+#define TCCR1C (*sim_strobe(0x82))
+#define TCNT1 (*sim_reg16(0x84))
+#define ICR1 (*sim_reg16(0x86))
+#define OCR1A (*sim_reg16(0x88))
+#define OCR1B (*sim_reg16(0x8A))
+
+#define TCCR2A (*sim_reg8(0xB0))
+#define TCCR2B (*sim_reg8(0xB1))
+#define TCNT2 (*sim_reg8(0xB2))
+#define OCR2A (*sim_reg8(0xB3))
+#define OCR2B (*sim_reg8(0xB4))
+#define ASSR (*sim_reg8(0xB6))
+
+#define UCSR0A (*sim_reg8(0xC0))
+#define UCSR0B (*sim_reg8(0xC1))
+#define UCSR0C (*sim_reg8(0xC2))
+#define UBRR0L (*sim_reg8(0xC4))
+#define UBRR0H (*sim_reg8(0xC5))
+#define UDR0 (*sim_strobe(0xC6))
+
+// SREG
+#define SREG_I 7
+#define SREG_T 6
+#define SREG_H 5
+#define SREG_S 4
+#define SREG_V 3
+#define SREG_N 2
+#define SREG_Z 1
+#define SREG_C 0
+
+// TIFR0, TIMSK0
+#define OCF0B 2
+#define OCF0A 1
+#define TOV0 0
+#define OCIE0B 2
+#define OCIE0A 1
+#define TOIE0 0
+
+// TIFR1, TIMSK1
+#define ICF1 5
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1 0
+#define ICIE1 5
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+
+// TIFR2, TIMSK2
+#define OCF2B 2
+#define OCF2A 1
+#define TOV2 0
+#define OCIE2B 2
+#define OCIE2A 1
+#define TOIE2 0
+
+// PCIFR, PCICR
+#define PCIF2 2
+#define PCIF1 1
+#define PCIF0 0
+#define PCIE2 2
+#define PCIE1 1
+#define PCIE0 0
+
+// EIFR, EIMSK, EICRA
+#define INTF1 1
+#define INTF0 0
+#define INT1 1
+#define INT0 0
+#define ISC11 3
+#define ISC10 2
+#define ISC01 1
+#define ISC00 0
+
+// PCMSK0
+#define PCINT7 7
+#define PCINT6 6
+#define PCINT5 5
+#define PCINT4 4
+#define PCINT3 3
+#define PCINT2 2
+#define PCINT1 1
+#define PCINT0 0
+
+// PCMSK1
+#define PCINT14 6
+#define PCINT13 5
+#define PCINT12 4
+#define PCINT11 3
+#define PCINT10 2
+#define PCINT9 1
+#define PCINT8 0
+
+// PCMSK2
+#define PCINT23 7
+#define PCINT22 6
+#define PCINT21 5
+#define PCINT20 4
+#define PCINT19 3
+#define PCINT18 2
+#define PCINT17 1
+#define PCINT16 0
+
+// TCCR0A, TCCR0B
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01 1
+#define WGM00 0
+#define FOC0A 7
+#define FOC0B 6
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+
+// TCCR1A, TCCR1B, TCCR1C
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11 1
+#define WGM10 0
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define FOC1A 7
+#define FOC1B 6
+
+// TCCR2A, TCCR2B
+#define COM2A1 7
+#define COM2A0 6
+#define COM2B1 5
+#define COM2B0 4
+#define WGM21 1
+#define WGM20 0
+#define FOC2A 7
+#define FOC2B 6
+#define WGM22 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+
+// SPCR, SPSR
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+
+// SMCR
+#define SM2 3
+#define SM1 2
+#define SM0 1
+#define SE 0
+
+// UCSR0A, UCSR0B, UCSR0C
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define MPCM0 0
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define RXB80 1
+#define TXB80 0
+#define UMSEL01 7
+#define UMSEL00 6
+#define UPM01 5
+#define UPM00 4
+#define USBS0 3
+#define UCSZ01 2
+#define UCSZ00 1
+#define UCPOL0 0
+
+// Interrupt vectors, numbered like avr-libc so the
+//   simulator can find the handlers by name
+#define INT0_vect __vector_1
+#define INT1_vect __vector_2
+#define PCINT0_vect __vector_3
+#define PCINT1_vect __vector_4
+#define PCINT2_vect __vector_5
+#define WDT_vect __vector_6
+#define TIMER2_COMPA_vect __vector_7
+#define TIMER2_COMPB_vect __vector_8
+#define TIMER2_OVF_vect __vector_9
+#define TIMER1_CAPT_vect __vector_10
+#define TIMER1_COMPA_vect __vector_11
+#define TIMER1_COMPB_vect __vector_12
+#define TIMER1_OVF_vect __vector_13
+#define TIMER0_COMPA_vect __vector_14
+#define TIMER0_COMPB_vect __vector_15
+#define TIMER0_OVF_vect __vector_16
+#define SPI_STC_vect __vector_17
+#define USART_RX_vect __vector_18
+#define USART_UDRE_vect __vector_19
+#define USART_TX_vect __vector_20
+#define ADC_vect __vector_21
+#define EE_READY_vect __vector_22
+#define ANALOG_COMP_vect __vector_23
+#define TWI_vect __vector_24
+#define SPM_READY_vect __vector_25
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <avr/io.h>
+
+// Sleep modes, shifted into the SM bits of SMCR
+#define SLEEP_MODE_IDLE (0x00 << 1)
+#define SLEEP_MODE_ADC (0x01 << 1)
+#define SLEEP_MODE_PWR_DOWN (0x02 << 1)
+#define SLEEP_MODE_PWR_SAVE (0x03 << 1)
+#define SLEEP_MODE_STANDBY (0x06 << 1)
+#define SLEEP_MODE_EXT_STANDBY (0x07 << 1)
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & (uint8_t)~((1 << SM2) | (1 << SM1) | (1 << SM0))) | (mode))
+#define sleep_enable() (SMCR |= (1 << SE))
+#define sleep_disable() (SMCR &= (uint8_t)~(1 << SE))
+
+// The simulator runs the clock forward until an interrupt is taken,
+//   it reads SE itself so no pending interrupt is delivered first
+#define sleep_cpu() sim_sleep()
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Pins are numbered like gpio_t, D0-D13 then A0-A5
+#define SIM_PIN_COUNT 20
+
+#define SIM_CYCLES_PER_US (F_CPU / 1000000UL)
+#define SIM_CYCLES_PER_MS (F_CPU / 1000UL)
+
+typedef void (*sim_watch_t)(uint64_t cycle, uint8_t pin, uint8_t level);
+typedef int (*sim_finish_t)(uint64_t cycle);
+typedef void (*sim_spi_t)(uint64_t cycle, uint8_t value);
+
+// Open the trace file, NULL to skip tracing
+void sim_init(const char *trace_path);
+// Stop the simulation at this cycle count
+void sim_set_end(uint64_t cycle);
+// Called on every pin level change
+void sim_set_watch(sim_watch_t watch);
+// Called once when the simulation ends, returns the exit status
+void sim_set_finish(sim_finish_t finish);
+// Called for every byte the SPI peripheral sends
+void sim_set_spi(sim_spi_t spi);
+
+// Drive an input pin to a level from the given cycle on
+void sim_drive(uint64_t cycle, uint8_t pin, uint8_t level);
+// Send text to the UART receiver from the given cycle on
+void sim_receive(uint64_t cycle, const char *text);
+// Send stdout through the firmware's UART one character at a time
+void sim_set_stdout(int (*put)(char c, FILE *stream));
+// Current pin level
+uint8_t sim_pin(uint8_t pin);
+
+uint64_t sim_cycles(void);
+// Cycles spent in sleep_cpu()
+uint64_t sim_sleep_cycles(void);
+const char *sim_pin_name(uint8_t pin);
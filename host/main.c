@@ -0,0 +1,604 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "gpio.h"
+#include "spi.h"
+
+// Host harness, runs the firmware against the simulator
+//   -n detents => Encoder detents to turn, negative turns the other way
+//   -r rate => Detents per second
+//   -s ms => When to start turning
+//   -t ms => How long to run, defaults to 500ms after the last detent
+//   -p pin@ms[:len] => Press a button for len ms, PRESS_MS by
+//     default, can be repeated
+//   -g count => Add short glitches on the encoder pins, spread
+//     out before the turning starts, to test noise handling
+//   -u ms:text => Send text to the UART at the given time, \n
+//     is a newline, can be repeated in time order
+//   -S pin => Step output to measure, D9 for OC1A output
+//   -D pin => Direction output
+//   -o file => Write every pin change to a CSV trace
+//   -e name=value => Check the result at the end, can be repeated,
+//     the exit status is 1 if any check fails
+//     steps => Step pulses sent
+//     high, low => Step pulses with the direction output high or low
+//     latency => Most microseconds from a detent to its first step
+//     display => Text on the display, e.g. "   0.0010"
+//     ratio => Steps per count of the display, e.g. 4 for the
+//       default gearing, holds whatever increments were used
+
+#define ENCODER_A_PIN D2
+#define ENCODER_B_PIN D3
+
+// Buttons are active low with external pullups
+static const gpio_t buttons[] = {D4, D5, D6};
+
+// MAX7219 pins, same as display.c
+#define DISPLAY_CS_PIN D10
+#if SPI_BACKEND == SPI_SOFTWARE
+	#define DISPLAY_SCK_PIN D11
+	#define DISPLAY_MOSI_PIN D12
+#endif
+
+#define PRESS_MS 200
+
+// Length of each encoder glitch, and when the first one can be
+//   so the firmware has finished starting up
+#define GLITCH_US 2
+#define GLITCH_START_MS 50
+#define MAX_PRESSES 16
+#define MAX_CHECKS 16
+
+// Encoder pin levels for each quarter of a detent, turning
+//   positive from the resting state with both pins high
+static const uint8_t quadrature[4][2] =
+{
+	{1, 0},
+	{0, 0},
+	{0, 1},
+	{1, 1},
+};
+
+// Segment patterns the firmware shows, the upper bit
+//   is the decimal point
+static const struct
+{
+	uint8_t segments;
+	char c;
+} glyphs[] =
+{
+	{0x7E, '0'}, {0x30, '1'}, {0x6D, '2'}, {0x79, '3'}, {0x33, '4'},
+	{0x5B, '5'}, {0x5F, '6'}, {0x70, '7'}, {0x7F, '8'}, {0x7B, '9'},
+	{0x01, '-'}, {0x00, ' '},
+};
+
+int firmware_main(void);
+
+static uint8_t step_pin = A0;
+static uint8_t dir_pin = A1;
+
+// Time each detent was completed, for latency
+static uint64_t *detents = NULL;
+static uint32_t detent_count = 0;
+static uint32_t detent_next = 0;
+
+static uint32_t steps = 0;
+static uint32_t steps_dir_high = 0;
+static uint32_t dir_changes = 0;
+static uint64_t first_step = 0;
+static uint64_t last_step = 0;
+
+static uint32_t latency_count = 0;
+static uint64_t latency_min = UINT64_MAX;
+static uint64_t latency_max = 0;
+static uint64_t latency_sum = 0;
+
+// Display digit registers as last written, index 0 is
+//   the rightmost digit
+static uint8_t display[8];
+// Bits clocked in since the chip select went low
+static uint16_t spi_shift = 0;
+static uint8_t spi_bits = 0;
+
+static const char *check_name[MAX_CHECKS];
+static const char *check_value[MAX_CHECKS];
+static uint8_t checks = 0;
+
+static int get_pin(const char *name)
+{
+	char *end;
+	long n = strtol(name + 1, &end, 10);
+
+	if ((end == (name + 1)) || ((*end != '\0') && (*end != '@')))
+	{
+		return -1;
+	}
+
+	if ((name[0] == 'D') && (n >= 0) && (n <= 13))
+	{
+		return D0 + n;
+	}
+
+	if ((name[0] == 'A') && (n >= 0) && (n <= 5))
+	{
+		return A0 + n;
+	}
+
+	return -1;
+}
+
+static double get_us(uint64_t cycles)
+{
+	return (double)cycles / SIM_CYCLES_PER_US;
+}
+
+static void display_latch(void)
+{
+	// The MAX7219 latches the last 16 bits in on the rising
+	//   edge of chip select, an opcode then its data
+	if (spi_bits >= 16)
+	{
+		uint8_t opcode = (spi_shift >> 8) & 0x0F;
+
+		if ((opcode >= 1) && (opcode <= 8))
+		{
+			display[opcode - 1] = (uint8_t)spi_shift;
+		}
+	}
+}
+
+static void spi_byte(uint64_t cycle, uint8_t value)
+{
+	(void)cycle;
+
+	// Hardware SPI, only bytes sent to the display
+	if (sim_pin(DISPLAY_CS_PIN) == 0)
+	{
+		spi_shift = (spi_shift << 8) | value;
+		spi_bits += 8;
+	}
+}
+
+static void get_display(char *text)
+{
+	// Leftmost digit first, with a '.' after any digit
+	//   that has the decimal point lit
+	for (int8_t i = 7; i >= 0; i--)
+	{
+		char c = '?';
+
+		for (uint8_t g = 0; g < (sizeof(glyphs) / sizeof(glyphs[0])); g++)
+		{
+			if (glyphs[g].segments == (display[i] & 0x7F))
+			{
+				c = glyphs[g].c;
+			}
+		}
+
+		*text++ = c;
+
+		if ((display[i] & 0x80) != 0)
+		{
+			*text++ = '.';
+		}
+	}
+
+	*text = '\0';
+}
+
+static void watch(uint64_t cycle, uint8_t pin, uint8_t level)
+{
+	if (pin == DISPLAY_CS_PIN)
+	{
+		if (level != 0)
+		{
+			display_latch();
+		}
+
+		// Start over for the next frame
+		spi_shift = 0;
+		spi_bits = 0;
+
+		return;
+	}
+
+	#if SPI_BACKEND == SPI_SOFTWARE
+		// Software SPI, mode 0 so data is read on the rising edge
+		if (pin == DISPLAY_SCK_PIN)
+		{
+			if ((level != 0) && (sim_pin(DISPLAY_CS_PIN) == 0))
+			{
+				spi_shift = (spi_shift << 1) | sim_pin(DISPLAY_MOSI_PIN);
+				spi_bits += 1;
+			}
+
+			return;
+		}
+	#endif
+
+	if (pin == dir_pin)
+	{
+		dir_changes += 1;
+
+		return;
+	}
+
+	// Count rising edges on the step output
+	if ((pin != step_pin) || (level == 0))
+	{
+		return;
+	}
+
+	if (steps == 0)
+	{
+		first_step = cycle;
+	}
+
+	last_step = cycle;
+	steps += 1;
+
+	if (sim_pin(dir_pin) != 0)
+	{
+		steps_dir_high += 1;
+	}
+
+	// Every detent waiting for output gets this step
+	while ((detent_next < detent_count) && (detents[detent_next] <= cycle))
+	{
+		uint64_t latency = cycle - detents[detent_next];
+
+		latency_min = (latency < latency_min) ? latency : latency_min;
+		latency_max = (latency > latency_max) ? latency : latency_max;
+		latency_sum += latency;
+		latency_count += 1;
+		detent_next += 1;
+	}
+}
+
+static int check(const char *name, const char *expected, const char *display_text)
+{
+	if (strcmp(name, "display") == 0)
+	{
+		if (strcmp(display_text, expected) == 0)
+		{
+			return 1;
+		}
+
+		fprintf(stderr, "FAIL: display is \"%s\", expected \"%s\"\n", display_text, expected);
+
+		return 0;
+	}
+
+	double value = strtod(expected, NULL);
+
+	if (strcmp(name, "ratio") == 0)
+	{
+		// Display digits without the sign and decimal point
+		uint32_t count = 0;
+
+		for (const char *c = display_text; *c != '\0'; c++)
+		{
+			if ((*c >= '0') && (*c <= '9'))
+			{
+				count = (count * 10) + (*c - '0');
+			}
+		}
+
+		if ((count != 0) && (steps == (uint32_t)value * count))
+		{
+			return 1;
+		}
+
+		fprintf(stderr, "FAIL: %u steps for a display of %u, expected %s per count\n", steps, count, expected);
+
+		return 0;
+	}
+
+	// Latency is an upper bound, the rest have to match
+	if (strcmp(name, "latency") == 0)
+	{
+		if (get_us(latency_max) <= value)
+		{
+			return 1;
+		}
+
+		fprintf(stderr, "FAIL: latency is %.3f us, expected at most %s us\n", get_us(latency_max), expected);
+
+		return 0;
+	}
+
+	uint32_t count = steps;
+
+	if (strcmp(name, "high") == 0)
+	{
+		count = steps_dir_high;
+	}
+	else if (strcmp(name, "low") == 0)
+	{
+		count = steps - steps_dir_high;
+	}
+
+	if (count == (uint32_t)value)
+	{
+		return 1;
+	}
+
+	fprintf(stderr, "FAIL: %s is %u, expected %s\n", name, count, expected);
+
+	return 0;
+}
+
+static int finish(uint64_t cycle)
+{
+	char text[20];
+	int status = 0;
+
+	get_display(text);
+
+	fprintf(stderr, "time: %.3f ms\n", get_us(cycle) / 1000.0);
+	fprintf(stderr, "idle: %.1f%%\n", (100.0 * sim_sleep_cycles()) / cycle);
+	fprintf(stderr, "detents: %u\n", detent_count);
+	fprintf(stderr, "steps: %u (dir high %u, dir low %u), dir changes: %u\n",
+		steps, steps_dir_high, steps - steps_dir_high, dir_changes);
+
+	if (latency_count != 0)
+	{
+		fprintf(stderr, "latency: min %.3f us, avg %.3f us, max %.3f us, no step %u\n",
+			get_us(latency_min), get_us(latency_sum) / latency_count, get_us(latency_max),
+			detent_count - latency_count);
+	}
+
+	if (steps > 1)
+	{
+		double span = get_us(last_step - first_step);
+
+		fprintf(stderr, "rate: %u steps in %.3f ms => %.0f steps/s\n",
+			steps, span / 1000.0, (steps - 1) * 1000000.0 / span);
+	}
+
+	fprintf(stderr, "display: \"%s\"\n", text);
+
+	for (uint8_t i = 0; i < checks; i++)
+	{
+		if (check(check_name[i], check_value[i], text) == 0)
+		{
+			status = 1;
+		}
+	}
+
+	return status;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n detents] [-r rate] [-s ms] [-t ms] [-g count] [-p pin@ms[:len]] [-u ms:text] [-S pin] [-D pin] [-o trace.csv] [-e name=value]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	long count = 10;
+	double rate = 20.0;
+	long glitches = 0;
+	double start_ms = 100.0;
+	double time_ms = 0.0;
+	const char *trace_path = NULL;
+	int press_pin[MAX_PRESSES];
+	double press_ms[MAX_PRESSES];
+	double press_len[MAX_PRESSES];
+	uint8_t presses = 0;
+	uint64_t last = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:s:t:g:p:u:S:D:o:e:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': count = strtol(optarg, NULL, 10); break;
+			case 'r': rate = strtod(optarg, NULL); break;
+			case 's': start_ms = strtod(optarg, NULL); break;
+			case 't': time_ms = strtod(optarg, NULL); break;
+			case 'g': glitches = strtol(optarg, NULL, 10); break;
+			case 'o': trace_path = optarg; break;
+
+			case 'e':
+			{
+				static const char *const names[] = {"steps", "high", "low", "latency", "display", "ratio"};
+				char *equals = strchr(optarg, '=');
+				uint8_t known = 0;
+
+				if ((checks >= MAX_CHECKS) || (equals == NULL))
+				{
+					usage(argv[0]);
+				}
+
+				*equals = '\0';
+
+				for (uint8_t i = 0; i < (sizeof(names) / sizeof(names[0])); i++)
+				{
+					known |= strcmp(optarg, names[i]) == 0;
+				}
+
+				if (known == 0)
+				{
+					usage(argv[0]);
+				}
+
+				check_name[checks] = optarg;
+				check_value[checks] = equals + 1;
+				checks += 1;
+
+				break;
+			}
+
+			case 'p':
+			{
+				char *at = strchr(optarg, '@');
+
+				if ((presses >= MAX_PRESSES) || (at == NULL) || ((press_pin[presses] = get_pin(optarg)) < 0))
+				{
+					usage(argv[0]);
+				}
+
+				char *len;
+
+				press_ms[presses] = strtod(at + 1, &len);
+				press_len[presses] = (*len == ':') ? strtod(len + 1, NULL) : PRESS_MS;
+				presses += 1;
+
+				break;
+			}
+
+			case 'u':
+			{
+				char *text;
+				uint64_t at = (uint64_t)(strtod(optarg, &text) * SIM_CYCLES_PER_MS);
+
+				if (*text != ':')
+				{
+					usage(argv[0]);
+				}
+
+				// Turn \n into newlines in place
+				char *in = text + 1;
+				char *out = text + 1;
+
+				while (*in != '\0')
+				{
+					if ((in[0] == '\\') && (in[1] == 'n'))
+					{
+						*out++ = '\n';
+						in += 2;
+					}
+					else
+					{
+						*out++ = *in++;
+					}
+				}
+
+				*out = '\0';
+				sim_receive(at, text + 1);
+
+				last = (at > last) ? at : last;
+
+				break;
+			}
+
+			case 'S':
+				// Fallthrough
+			case 'D':
+			{
+				int pin = get_pin(optarg);
+
+				if (pin < 0)
+				{
+					usage(argv[0]);
+				}
+
+				if (opt == 'S')
+				{
+					step_pin = pin;
+				}
+				else
+				{
+					dir_pin = pin;
+				}
+
+				break;
+			}
+
+			default:
+			{
+				usage(argv[0]);
+			}
+		}
+	}
+
+	if (rate <= 0.0)
+	{
+		usage(argv[0]);
+	}
+
+	sim_init(trace_path);
+	sim_set_watch(watch);
+	sim_set_finish(finish);
+	sim_set_spi(spi_byte);
+
+	// Encoder resting on a detent, buttons released
+	sim_drive(0, ENCODER_A_PIN, 1);
+	sim_drive(0, ENCODER_B_PIN, 1);
+
+	for (uint8_t i = 0; i < (sizeof(buttons) / sizeof(buttons[0])); i++)
+	{
+		sim_drive(0, buttons[i], 1);
+	}
+
+	for (uint8_t i = 0; i < presses; i++)
+	{
+		uint64_t down = (uint64_t)(press_ms[i] * SIM_CYCLES_PER_MS);
+		uint64_t up = down + (uint64_t)(press_len[i] * SIM_CYCLES_PER_MS);
+
+		sim_drive(down, press_pin[i], 0);
+		sim_drive(up, press_pin[i], 1);
+
+		last = (up > last) ? up : last;
+	}
+
+	// Glitches pull A or B low for a moment while the encoder
+	//   is resting with both pins high
+	if ((glitches > 0) && (start_ms > GLITCH_START_MS))
+	{
+		uint64_t first = (uint64_t)GLITCH_START_MS * SIM_CYCLES_PER_MS;
+		uint64_t spacing = ((uint64_t)(start_ms * SIM_CYCLES_PER_MS) - first) / (glitches + 1);
+
+		for (long i = 0; i < glitches; i++)
+		{
+			uint8_t pin = ((i & 1) == 0) ? ENCODER_A_PIN : ENCODER_B_PIN;
+			uint64_t down = first + ((i + 1) * spacing);
+
+			sim_drive(down, pin, 0);
+			sim_drive(down + ((uint64_t)GLITCH_US * SIM_CYCLES_PER_US), pin, 1);
+		}
+	}
+
+	// Each detent is four evenly spaced edges, the last one
+	//   is where the firmware sees the detent
+	uint64_t period = (uint64_t)(F_CPU / rate);
+	uint64_t at = (uint64_t)(start_ms * SIM_CYCLES_PER_MS);
+	uint8_t reverse = count < 0;
+
+	detent_count = (uint32_t)labs(count);
+	detents = calloc(detent_count + 1, sizeof(uint64_t));
+
+	for (uint32_t i = 0; i < detent_count; i++)
+	{
+		for (uint8_t q = 0; q < 4; q++)
+		{
+			// Turning the other way runs the same states with A and B swapped
+			uint8_t a = quadrature[q][reverse ? 1 : 0];
+			uint8_t b = quadrature[q][reverse ? 0 : 1];
+
+			at += period / 4;
+			sim_drive(at, ENCODER_A_PIN, a);
+			sim_drive(at, ENCODER_B_PIN, b);
+		}
+
+		detents[i] = at;
+	}
+
+	last = (at > last) ? at : last;
+
+	if (time_ms <= 0.0)
+	{
+		time_ms = (last / (double)SIM_CYCLES_PER_MS) + 500.0;
+	}
+
+	sim_set_end((uint64_t)(time_ms * SIM_CYCLES_PER_MS));
+
+	// Never returns, the simulator exits at the end time
+	return firmware_main();
+}
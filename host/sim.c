@@ -0,0 +1,1083 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "sim.h"
+
+// Rough cost of the code around each register access
+//   Code in between accesses runs in zero time, so this
+//   only gives relative numbers, not exact cycle counts
+#define ACCESS_CYCLES 4
+// Interrupt response, vector jump and ISR prologue/epilogue
+#define ISR_CYCLES 32
+
+// Most received UART characters that can be scheduled
+#define RX_COUNT 4096
+
+// Most pin changes that can be scheduled
+#define EVENT_COUNT 65536
+
+// Register addresses, the macros in avr/io.h call into here
+#define ADDR_PINB 0x23
+#define ADDR_PINC 0x26
+#define ADDR_PIND 0x29
+#define ADDR_TIFR0 0x35
+#define ADDR_TIFR1 0x36
+#define ADDR_TIFR2 0x37
+#define ADDR_PCIFR 0x3B
+#define ADDR_EIFR 0x3C
+#define ADDR_EIMSK 0x3D
+#define ADDR_TCCR0A 0x44
+#define ADDR_TCCR0B 0x45
+#define ADDR_TCNT0 0x46
+#define ADDR_OCR0A 0x47
+#define ADDR_OCR0B 0x48
+#define ADDR_SPCR 0x4C
+#define ADDR_SPSR 0x4D
+#define ADDR_SPDR 0x4E
+#define ADDR_SMCR 0x53
+#define ADDR_SREG 0x5F
+#define ADDR_PCICR 0x68
+#define ADDR_EICRA 0x69
+#define ADDR_PCMSK0 0x6B
+#define ADDR_TIMSK0 0x6E
+#define ADDR_TIMSK1 0x6F
+#define ADDR_TIMSK2 0x70
+#define ADDR_TCCR1A 0x80
+#define ADDR_TCCR1B 0x81
+#define ADDR_TCCR1C 0x82
+#define ADDR_TCNT1 0x84
+#define ADDR_ICR1 0x86
+#define ADDR_OCR1A 0x88
+#define ADDR_OCR1B 0x8A
+#define ADDR_TCCR2A 0xB0
+#define ADDR_TCCR2B 0xB1
+#define ADDR_TCNT2 0xB2
+#define ADDR_OCR2A 0xB3
+#define ADDR_OCR2B 0xB4
+#define ADDR_UCSR0A 0xC0
+#define ADDR_UCSR0B 0xC1
+#define ADDR_UBRR0L 0xC4
+#define ADDR_UBRR0H 0xC5
+#define ADDR_UDR0 0xC6
+
+// Ports in PCINT order, each has PIN, DDR, PORT in a row
+#define PORT_B 0
+#define PORT_C 1
+#define PORT_D 2
+#define PORT_COUNT 3
+
+typedef struct
+{
+	uint64_t cycle;
+	uint8_t pin;
+	uint8_t level;
+} event_t;
+
+// Plain registers, read and written in place
+static uint8_t io[0x100];
+// 16 bit registers, indexed by the low byte address
+static uint16_t wide[0x100];
+// Registers with side effects on write, the simulator publishes
+//   read values here and the firmware gets read only pointers,
+//   writes come in through sim_write()
+static uint8_t strobe[0x100];
+
+static const uint8_t port_base[PORT_COUNT] = {ADDR_PINB, ADDR_PINC, ADDR_PIND};
+
+static const char *const pin_names[SIM_PIN_COUNT] =
+{
+	"D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
+	"D8", "D9", "D10", "D11", "D12", "D13",
+	"A0", "A1", "A2", "A3", "A4", "A5",
+};
+
+static uint64_t cycles = 0;
+static uint64_t sleep_cycles = 0;
+// Interrupts delivered so far, sleep runs until this changes
+static uint64_t isr_count = 0;
+static uint64_t end_cycles = UINT64_MAX;
+static uint8_t finished = 0;
+
+static FILE *trace_file = NULL;
+static FILE *console = NULL;
+static sim_watch_t watch = NULL;
+static sim_finish_t finish = NULL;
+static sim_spi_t spi_sent = NULL;
+
+// Scheduled input changes, kept in time order
+static event_t events[EVENT_COUNT];
+static uint32_t event_count = 0;
+static uint32_t event_next = 0;
+
+// External drive on each port, and which pins it applies to
+static uint8_t ext_level[PORT_COUNT];
+static uint8_t ext_driven[PORT_COUNT];
+// Pin levels as of the last update
+static uint8_t pins[PORT_COUNT];
+static uint8_t pins_dirty = 1;
+
+static uint8_t timer_flags[3];
+static uint8_t eifr = 0;
+static uint8_t pcifr = 0;
+static uint8_t oc1a = 0;
+static uint8_t oc1b = 0;
+
+static uint8_t spif = 0;
+static uint8_t wcol = 0;
+static uint8_t spif_seen = 0;
+static uint32_t spi_left = 0;
+
+static uint8_t udre = 1;
+static uint8_t txc = 0;
+static uint8_t tx_data = 0;
+static uint8_t tx_shift = 0;
+static uint32_t tx_left = 0;
+
+// Scheduled UART input, each character starts arriving at its
+//   time or when the one before it is done, whichever is later
+static uint64_t rx_cycle[RX_COUNT];
+static uint8_t rx_char[RX_COUNT];
+static uint32_t rx_count = 0;
+static uint32_t rx_next = 0;
+static uint32_t rx_left = 0;
+static uint8_t rx_data = 0;
+static uint8_t rxc = 0;
+static uint8_t dor = 0;
+// Set when UDR0 was touched, a read if nothing was written
+static uint8_t udr_touched = 0;
+
+static int (*stdout_put)(char c, FILE *stream) = NULL;
+
+static const uint16_t prescale01[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+static const uint16_t prescale2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+// Weak handlers for every vector, the firmware ISR() overrides them
+#define VECTOR(n) __attribute__((weak)) void __vector_##n(void); void __vector_##n(void) {}
+VECTOR(1) VECTOR(2) VECTOR(3) VECTOR(4) VECTOR(5) VECTOR(6) VECTOR(7) VECTOR(8)
+VECTOR(9) VECTOR(10) VECTOR(11) VECTOR(12) VECTOR(13) VECTOR(14) VECTOR(15) VECTOR(16)
+VECTOR(17) VECTOR(18) VECTOR(19) VECTOR(20) VECTOR(21) VECTOR(22) VECTOR(23) VECTOR(24)
+VECTOR(25)
+#undef VECTOR
+
+static void (*const vectors[26])(void) =
+{
+	NULL,
+	__vector_1, __vector_2, __vector_3, __vector_4, __vector_5,
+	__vector_6, __vector_7, __vector_8, __vector_9, __vector_10,
+	__vector_11, __vector_12, __vector_13, __vector_14, __vector_15,
+	__vector_16, __vector_17, __vector_18, __vector_19, __vector_20,
+	__vector_21, __vector_22, __vector_23, __vector_24, __vector_25,
+};
+
+static void collect(void);
+
+static void trace(const char *signal, unsigned value)
+{
+	if (trace_file == NULL)
+	{
+		return;
+	}
+
+	// Time in microseconds with 4 decimal places
+	uint64_t us = cycles / SIM_CYCLES_PER_US;
+	uint64_t fraction = ((cycles % SIM_CYCLES_PER_US) * 10000) / SIM_CYCLES_PER_US;
+
+	fprintf(trace_file, "%llu,%llu.%04llu,%s,%u\n", (unsigned long long)cycles,
+		(unsigned long long)us, (unsigned long long)fraction, signal, value);
+}
+
+static void stop(void)
+{
+	// Only once, the finish callback may touch registers
+	if (finished != 0)
+	{
+		return;
+	}
+
+	finished = 1;
+
+	int status = 0;
+
+	if (finish != NULL)
+	{
+		status = finish(cycles);
+	}
+
+	if (trace_file != NULL)
+	{
+		fclose(trace_file);
+	}
+
+	fflush(console);
+	exit(status);
+}
+
+static void get_port(uint8_t pin, uint8_t *port, uint8_t *bit)
+{
+	// Same mapping as the Arduino pin numbers
+	if (pin <= 7)
+	{
+		*port = PORT_D;
+		*bit = pin;
+	}
+	else if (pin <= 13)
+	{
+		*port = PORT_B;
+		*bit = pin - 8;
+	}
+	else
+	{
+		*port = PORT_C;
+		*bit = pin - 14;
+	}
+}
+
+static uint8_t get_pin(uint8_t port, uint8_t bit)
+{
+	static const uint8_t first[PORT_COUNT] = {8, 14, 0};
+
+	// PB6/7 are the crystal and PC6 is reset
+	if ((port != PORT_D) && (bit >= 6))
+	{
+		return SIM_PIN_COUNT;
+	}
+
+	return first[port] + bit;
+}
+
+static void edge_interrupt(uint8_t bit, uint8_t level, uint8_t sense)
+{
+	// External interrupt sense, 0 is low level which isn't modeled
+	//   1 => Any change, 2 => Falling, 3 => Rising
+	if ((sense == 1) || ((sense == 2) && (level == 0)) || ((sense == 3) && (level != 0)))
+	{
+		eifr |= bit;
+	}
+}
+
+static void update_pins(void)
+{
+	pins_dirty = 0;
+
+	for (uint8_t p = 0; p < PORT_COUNT; p++)
+	{
+		uint8_t ddr = io[port_base[p] + 1];
+		uint8_t port = io[port_base[p] + 2];
+
+		// Inputs read the external level, or the pullup if
+		//   nothing is driving them
+		uint8_t input = (ext_driven[p] & ext_level[p]) | ((uint8_t)~ext_driven[p] & port);
+		uint8_t level = (ddr & port) | ((uint8_t)~ddr & input);
+
+		// Timer 1 compare outputs take over the port pins
+		if (p == PORT_B)
+		{
+			if (((io[ADDR_TCCR1A] & ((1 << COM1A1) | (1 << COM1A0))) != 0) && ((ddr & 0x02) != 0))
+			{
+				level = (level & 0xFD) | (oc1a << 1);
+			}
+
+			if (((io[ADDR_TCCR1A] & ((1 << COM1B1) | (1 << COM1B0))) != 0) && ((ddr & 0x04) != 0))
+			{
+				level = (level & 0xFB) | (oc1b << 2);
+			}
+		}
+
+		uint8_t changed = level ^ pins[p];
+
+		if (changed == 0)
+		{
+			continue;
+		}
+
+		pins[p] = level;
+
+		// Pin change interrupts see outputs too
+		if ((changed & io[ADDR_PCMSK0 + p]) != 0)
+		{
+			pcifr |= 1 << p;
+		}
+
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			uint8_t mask = 1 << bit;
+
+			if ((changed & mask) == 0)
+			{
+				continue;
+			}
+
+			uint8_t pin = get_pin(p, bit);
+			uint8_t high = (level & mask) != 0;
+
+			if ((p == PORT_D) && (bit == 2))
+			{
+				edge_interrupt(1 << INTF0, high, io[ADDR_EICRA] & 0x03);
+			}
+			else if ((p == PORT_D) && (bit == 3))
+			{
+				edge_interrupt(1 << INTF1, high, (io[ADDR_EICRA] >> 2) & 0x03);
+			}
+
+			if (pin >= SIM_PIN_COUNT)
+			{
+				continue;
+			}
+
+			// Only trace pins something is driving
+			if (((ddr | ext_driven[p]) & mask) != 0)
+			{
+				trace(pin_names[pin], high);
+			}
+
+			if (watch != NULL)
+			{
+				watch(cycles, pin, high);
+			}
+		}
+	}
+}
+
+static void compare_output(uint8_t mode, uint8_t *output)
+{
+	// 1 => Toggle, 2 => Clear, 3 => Set
+	switch (mode)
+	{
+		case 1: *output ^= 1; break;
+		case 2: *output = 0; break;
+		case 3: *output = 1; break;
+		default: return;
+	}
+
+	pins_dirty = 1;
+}
+
+static void count8(uint8_t n, uint8_t tccra, uint8_t tccrb, uint8_t tcnt, uint8_t ocra, uint8_t ocrb, const uint16_t *prescale)
+{
+	uint16_t div = prescale[io[tccrb] & 0x07];
+
+	// If the timer is stopped or this isn't a timer clock,
+	if ((div == 0) || ((cycles % div) != 0))
+	{
+		return;
+	}
+
+	uint8_t count = io[tcnt];
+	// Mode 2 => Clear on compare A, everything else counts to 0xFF
+	uint8_t ctc = ((io[tccra] & 0x03) == 0x02) && ((io[tccrb] & 0x08) == 0);
+
+	if (count == io[ocra])
+	{
+		timer_flags[n] |= 1 << 1;
+	}
+
+	if (count == io[ocrb])
+	{
+		timer_flags[n] |= 1 << 2;
+	}
+
+	if (ctc && (count == io[ocra]))
+	{
+		count = 0;
+	}
+	else
+	{
+		if (count == 0xFF)
+		{
+			timer_flags[n] |= 1 << 0;
+		}
+
+		count += 1;
+	}
+
+	io[tcnt] = count;
+}
+
+static void count16(void)
+{
+	uint16_t div = prescale01[io[ADDR_TCCR1B] & 0x07];
+
+	if ((div == 0) || ((cycles % div) != 0))
+	{
+		return;
+	}
+
+	uint16_t count = wide[ADDR_TCNT1];
+	uint8_t mode = (io[ADDR_TCCR1A] & 0x03) | ((io[ADDR_TCCR1B] >> 1) & 0x0C);
+	uint16_t top = 0xFFFF;
+
+	// Mode 4 => Clear on OCR1A, mode 12 => Clear on ICR1,
+	//   the PWM modes aren't modeled and count like mode 0
+	if (mode == 4)
+	{
+		top = wide[ADDR_OCR1A];
+	}
+	else if (mode == 12)
+	{
+		top = wide[ADDR_ICR1];
+	}
+
+	if (count == wide[ADDR_OCR1A])
+	{
+		timer_flags[1] |= 1 << OCF1A;
+		compare_output(io[ADDR_TCCR1A] >> 6, &oc1a);
+	}
+
+	if (count == wide[ADDR_OCR1B])
+	{
+		timer_flags[1] |= 1 << OCF1B;
+		compare_output((io[ADDR_TCCR1A] >> 4) & 0x03, &oc1b);
+	}
+
+	if (count == top)
+	{
+		if (top == 0xFFFF)
+		{
+			timer_flags[1] |= 1 << TOV1;
+		}
+		else if (mode == 12)
+		{
+			timer_flags[1] |= 1 << ICF1;
+		}
+
+		count = 0;
+	}
+	else
+	{
+		count += 1;
+	}
+
+	wide[ADDR_TCNT1] = count;
+}
+
+static uint32_t get_spi_cycles(void)
+{
+	static const uint8_t divider[4] = {4, 16, 64, 128};
+	uint32_t div = divider[io[ADDR_SPCR] & 0x03];
+
+	if ((io[ADDR_SPSR] & (1 << SPI2X)) != 0)
+	{
+		div /= 2;
+	}
+
+	return div * 8;
+}
+
+static uint32_t get_frame_cycles(void)
+{
+	uint16_t ubrr = ((io[ADDR_UBRR0H] << 8) | io[ADDR_UBRR0L]) & 0x0FFF;
+	uint32_t bit = (uint32_t)(ubrr + 1) * (((io[ADDR_UCSR0A] & (1 << U2X0)) != 0) ? 8 : 16);
+
+	// Start, 8 data and stop bits
+	return bit * 10;
+}
+
+static void uart_sent(void)
+{
+	fputc(tx_shift, console);
+	trace("UART", tx_shift);
+
+	// If another character is waiting, start on it
+	if (udre == 0)
+	{
+		tx_shift = tx_data;
+		tx_left = get_frame_cycles();
+		udre = 1;
+	}
+	else
+	{
+		txc = 1;
+	}
+}
+
+static void uart_start(uint8_t value)
+{
+	if ((io[ADDR_UCSR0B] & (1 << TXEN0)) == 0)
+	{
+		return;
+	}
+
+	if (tx_left == 0)
+	{
+		// Shift register is free, the data register stays empty
+		tx_shift = value;
+		tx_left = get_frame_cycles();
+	}
+	else if (udre != 0)
+	{
+		tx_data = value;
+		udre = 0;
+	}
+}
+
+static void uart_received(void)
+{
+	// Only one character is buffered, an unread one is lost
+	if (rxc != 0)
+	{
+		dor = 1;
+	}
+
+	rx_data = rx_char[rx_next];
+	rxc = 1;
+	rx_next += 1;
+}
+
+static void spi_start(uint8_t value)
+{
+	if ((io[ADDR_SPCR] & (1 << SPE)) == 0)
+	{
+		return;
+	}
+
+	// Writing during a transfer is a collision
+	if (spi_left != 0)
+	{
+		wcol = 1;
+
+		return;
+	}
+
+	spi_left = get_spi_cycles();
+	trace("SPI", value);
+
+	// The byte isn't clocked out on the pins, hand it over whole
+	if (spi_sent != NULL)
+	{
+		spi_sent(cycles, value);
+	}
+}
+
+static void advance(uint64_t count)
+{
+	while (count-- != 0)
+	{
+		cycles += 1;
+
+		count8(0, ADDR_TCCR0A, ADDR_TCCR0B, ADDR_TCNT0, ADDR_OCR0A, ADDR_OCR0B, prescale01);
+		count16();
+		count8(2, ADDR_TCCR2A, ADDR_TCCR2B, ADDR_TCNT2, ADDR_OCR2A, ADDR_OCR2B, prescale2);
+
+		if ((spi_left != 0) && (--spi_left == 0))
+		{
+			spif = 1;
+		}
+
+		if ((tx_left != 0) && (--tx_left == 0))
+		{
+			uart_sent();
+		}
+
+		// Start receiving the next character once it is due
+		if ((rx_left == 0) && (rx_next < rx_count) && (rx_cycle[rx_next] <= cycles)
+			&& ((io[ADDR_UCSR0B] & (1 << RXEN0)) != 0))
+		{
+			rx_left = get_frame_cycles();
+		}
+		else if ((rx_left != 0) && (--rx_left == 0))
+		{
+			uart_received();
+		}
+
+		// Apply scheduled input changes
+		while ((event_next < event_count) && (events[event_next].cycle <= cycles))
+		{
+			uint8_t port;
+			uint8_t bit;
+
+			get_port(events[event_next].pin, &port, &bit);
+			ext_driven[port] |= 1 << bit;
+
+			if (events[event_next].level != 0)
+			{
+				ext_level[port] |= 1 << bit;
+			}
+			else
+			{
+				ext_level[port] &= ~(1 << bit);
+			}
+
+			event_next += 1;
+			pins_dirty = 1;
+		}
+
+		if (pins_dirty != 0)
+		{
+			update_pins();
+		}
+
+		if (cycles >= end_cycles)
+		{
+			stop();
+		}
+	}
+}
+
+static uint8_t take_vector(void)
+{
+	// Highest priority first, flags are cleared by the hardware
+	//   when the vector is taken except for the UART ones
+	static const uint8_t timer_vector[3] = {14, 0, 7};
+	uint8_t pending = eifr & io[ADDR_EIMSK];
+
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		if ((pending & (1 << i)) != 0)
+		{
+			eifr &= ~(1 << i);
+
+			return 1 + i;
+		}
+	}
+
+	pending = pcifr & io[ADDR_PCICR];
+
+	for (uint8_t i = 0; i < PORT_COUNT; i++)
+	{
+		if ((pending & (1 << i)) != 0)
+		{
+			pcifr &= ~(1 << i);
+
+			return 3 + i;
+		}
+	}
+
+	// Timer 2, then 1, then 0
+	for (int8_t n = 2; n >= 0; n--)
+	{
+		pending = timer_flags[n] & io[ADDR_TIMSK0 + n];
+
+		if (n == 1)
+		{
+			// Capture, compare A, compare B, overflow
+			static const uint8_t order[4] = {ICF1, OCF1A, OCF1B, TOV1};
+
+			for (uint8_t i = 0; i < 4; i++)
+			{
+				if ((pending & (1 << order[i])) != 0)
+				{
+					timer_flags[1] &= ~(1 << order[i]);
+
+					return 10 + i;
+				}
+			}
+
+			continue;
+		}
+
+		// Compare A, compare B, overflow
+		static const uint8_t order[3] = {1, 2, 0};
+
+		for (uint8_t i = 0; i < 3; i++)
+		{
+			if ((pending & (1 << order[i])) != 0)
+			{
+				timer_flags[n] &= ~(1 << order[i]);
+
+				return timer_vector[n] + i;
+			}
+		}
+	}
+
+	if ((spif != 0) && ((io[ADDR_SPCR] & ((1 << SPIE) | (1 << SPE))) == ((1 << SPIE) | (1 << SPE))))
+	{
+		spif = 0;
+
+		return 17;
+	}
+
+	if ((rxc != 0) && ((io[ADDR_UCSR0B] & (1 << RXCIE0)) != 0))
+	{
+		return 18;
+	}
+
+	if ((udre != 0) && ((io[ADDR_UCSR0B] & (1 << UDRIE0)) != 0))
+	{
+		return 19;
+	}
+
+	if ((txc != 0) && ((io[ADDR_UCSR0B] & (1 << TXCIE0)) != 0))
+	{
+		txc = 0;
+
+		return 20;
+	}
+
+	return 0;
+}
+
+static void dispatch(void)
+{
+	// While interrupts are enabled and one is pending,
+	while ((io[ADDR_SREG] & (1 << SREG_I)) != 0)
+	{
+		uint8_t vector = take_vector();
+
+		if (vector == 0)
+		{
+			break;
+		}
+
+		// Run the handler with interrupts disabled, reti turns them back on
+		io[ADDR_SREG] &= ~(1 << SREG_I);
+		isr_count += 1;
+		advance(ISR_CYCLES);
+		vectors[vector]();
+		io[ADDR_SREG] |= 1 << SREG_I;
+
+		// The handler's last accesses count before the next vector
+		collect();
+	}
+}
+
+static void strobe_write(uint8_t addr, uint8_t value)
+{
+	switch (addr)
+	{
+		case ADDR_PINB:
+			// Fallthrough
+		case ADDR_PINC:
+			// Fallthrough
+		case ADDR_PIND:
+		{
+			// Writing a 1 toggles the output
+			io[addr + 2] ^= value;
+
+			break;
+		}
+
+		case ADDR_TIFR0:
+			// Fallthrough
+		case ADDR_TIFR1:
+			// Fallthrough
+		case ADDR_TIFR2:
+		{
+			// Writing a 1 clears the flag
+			timer_flags[addr - ADDR_TIFR0] &= ~value;
+
+			break;
+		}
+
+		case ADDR_PCIFR:
+		{
+			pcifr &= ~value;
+
+			break;
+		}
+
+		case ADDR_EIFR:
+		{
+			eifr &= ~value;
+
+			break;
+		}
+
+		case ADDR_SPDR:
+		{
+			spi_start(value);
+
+			break;
+		}
+
+		case ADDR_TCCR1C:
+		{
+			// Force output compare, no flag and no interrupt
+			if ((value & (1 << FOC1A)) != 0)
+			{
+				compare_output(io[ADDR_TCCR1A] >> 6, &oc1a);
+			}
+
+			if ((value & (1 << FOC1B)) != 0)
+			{
+				compare_output((io[ADDR_TCCR1A] >> 4) & 0x03, &oc1b);
+			}
+
+			break;
+		}
+
+		case ADDR_UDR0:
+		{
+			// Not a read, keep the received character
+			udr_touched = 0;
+			uart_start(value);
+
+			break;
+		}
+	}
+}
+
+static void collect(void)
+{
+	// Touching UDR0 without writing it was a read, which
+	//   takes the received character
+	if (udr_touched != 0)
+	{
+		rxc = 0;
+		dor = 0;
+	}
+
+	udr_touched = 0;
+
+	// Port and direction writes land in place
+	update_pins();
+}
+
+static void publish(void)
+{
+	for (uint8_t p = 0; p < PORT_COUNT; p++)
+	{
+		strobe[port_base[p]] = pins[p];
+	}
+
+	for (uint8_t n = 0; n < 3; n++)
+	{
+		strobe[ADDR_TIFR0 + n] = timer_flags[n];
+	}
+
+	strobe[ADDR_PCIFR] = pcifr;
+	strobe[ADDR_EIFR] = eifr;
+	strobe[ADDR_SPDR] = 0;
+	strobe[ADDR_TCCR1C] = 0;
+	strobe[ADDR_UDR0] = rx_data;
+
+	// Status bits can't be written
+	io[ADDR_SPSR] = (io[ADDR_SPSR] & (1 << SPI2X)) | (spif << SPIF) | (wcol << WCOL);
+	io[ADDR_UCSR0A] = (io[ADDR_UCSR0A] & ((1 << U2X0) | (1 << MPCM0))) | (rxc << RXC0) | (txc << TXC0) | (udre << UDRE0) | (dor << DOR0);
+}
+
+static void reg_access(uint8_t addr)
+{
+	collect();
+	advance(ACCESS_CYCLES);
+	dispatch();
+
+	// SPIF clears on reading SPSR with it set, then touching SPDR
+	if (addr == ADDR_SPSR)
+	{
+		spif_seen = spif;
+	}
+	else if ((addr == ADDR_SPDR) && (spif_seen != 0))
+	{
+		spif = 0;
+		wcol = 0;
+		spif_seen = 0;
+	}
+	else if (addr == ADDR_UDR0)
+	{
+		udr_touched = 1;
+	}
+
+	publish();
+}
+
+volatile uint8_t *sim_reg8(uint8_t addr)
+{
+	reg_access(addr);
+
+	return &io[addr];
+}
+
+volatile uint16_t *sim_reg16(uint8_t addr)
+{
+	reg_access(addr);
+
+	return &wide[addr];
+}
+
+const volatile uint8_t *sim_strobe(uint8_t addr)
+{
+	reg_access(addr);
+
+	return &strobe[addr];
+}
+
+void sim_write(const volatile uint8_t *reg, uint8_t value)
+{
+	// The register was just accessed through sim_strobe() to
+	//   get its address, the write happens right after it
+	strobe_write((uint8_t)(reg - strobe), value);
+	update_pins();
+	publish();
+}
+
+void sim_sleep(void)
+{
+	uint64_t count = isr_count;
+	uint64_t start = cycles;
+
+	collect();
+
+	// The sleep instruction does nothing unless it is enabled
+	if ((io[ADDR_SMCR] & (1 << SE)) == 0)
+	{
+		publish();
+
+		return;
+	}
+
+	// Only the idle mode is modeled, every interrupt source wakes
+	//   it up. An interrupt that is already pending is taken right
+	//   away, like one enabled by the sei() just before the sleep
+	//   Sleeping with interrupts disabled never wakes, same as the
+	//   real part, the run just ends at the end time
+	while (isr_count == count)
+	{
+		advance(1);
+		dispatch();
+	}
+
+	sleep_cycles += cycles - start;
+	publish();
+}
+
+static ssize_t stdout_write(void *cookie, const char *buffer, size_t size)
+{
+	(void)cookie;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		stdout_put(buffer[i], stdout);
+	}
+
+	return size;
+}
+
+void sim_set_stdout(int (*put)(char c, FILE *stream))
+{
+	cookie_io_functions_t functions = {.write = stdout_write};
+	FILE *stream = fopencookie(NULL, "w", functions);
+
+	if (stream == NULL)
+	{
+		return;
+	}
+
+	// Every character goes straight to the firmware
+	setvbuf(stream, NULL, _IONBF, 0);
+	stdout_put = put;
+	stdout = stream;
+}
+
+void sim_init(const char *trace_path)
+{
+	console = stdout;
+
+	if (trace_path != NULL)
+	{
+		trace_file = fopen(trace_path, "w");
+
+		if (trace_file == NULL)
+		{
+			perror(trace_path);
+			exit(1);
+		}
+
+		fprintf(trace_file, "cycle,time_us,signal,value\n");
+	}
+
+	// Start with the levels every pin has out of reset
+	update_pins();
+	publish();
+}
+
+void sim_set_end(uint64_t cycle)
+{
+	end_cycles = cycle;
+}
+
+void sim_set_watch(sim_watch_t callback)
+{
+	watch = callback;
+}
+
+void sim_set_finish(sim_finish_t callback)
+{
+	finish = callback;
+}
+
+void sim_set_spi(sim_spi_t callback)
+{
+	spi_sent = callback;
+}
+
+void sim_drive(uint64_t cycle, uint8_t pin, uint8_t level)
+{
+	if ((pin >= SIM_PIN_COUNT) || (event_count >= EVENT_COUNT))
+	{
+		fprintf(stderr, "sim: can't drive %u\n", pin);
+		exit(1);
+	}
+
+	// Insert in time order, after anything at the same time
+	uint32_t i = event_count;
+
+	while ((i > event_next) && (events[i - 1].cycle > cycle))
+	{
+		events[i] = events[i - 1];
+		i -= 1;
+	}
+
+	events[i].cycle = cycle;
+	events[i].pin = pin;
+	events[i].level = level;
+	event_count += 1;
+}
+
+void sim_receive(uint64_t cycle, const char *text)
+{
+	for (; *text != '\0'; text++)
+	{
+		if (rx_count >= RX_COUNT)
+		{
+			fprintf(stderr, "sim: too much UART input\n");
+			exit(1);
+		}
+
+		// Characters have to be scheduled in time order
+		if ((rx_count != 0) && (cycle < rx_cycle[rx_count - 1]))
+		{
+			cycle = rx_cycle[rx_count - 1];
+		}
+
+		rx_cycle[rx_count] = cycle;
+		rx_char[rx_count] = (uint8_t)*text;
+		rx_count += 1;
+	}
+}
+
+uint8_t sim_pin(uint8_t pin)
+{
+	uint8_t port;
+	uint8_t bit;
+
+	get_port(pin, &port, &bit);
+
+	return (pins[port] >> bit) & 0x01;
+}
+
+uint64_t sim_cycles(void)
+{
+	return cycles;
+}
+
+uint64_t sim_sleep_cycles(void)
+{
+	return sleep_cycles;
+}
+
+const char *sim_pin_name(uint8_t pin)
+{
+	if (pin >= SIM_PIN_COUNT)
+	{
+		return "?";
+	}
+
+	return pin_names[pin];
+}
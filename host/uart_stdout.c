@@ -0,0 +1,12 @@
+#include <stdio.h>
+
+#include "sim.h"
+#include "uart.h"
+
+// Host version of src/uart_stdout.c, there is no avr-libc
+//   FDEV_SETUP_STREAM so the simulator wraps uart_putchar()
+//   in a stream of its own
+void uart_stdout_init(void)
+{
+	sim_set_stdout(uart_putchar);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+typedef enum
+{
+	BUTTON_ZERO,
+	BUTTON_COARSE,
+	BUTTON_FINE,
+	BUTTON_COUNT,
+} button_t;
+
+typedef enum
+{
+	// Button went down
+	BUTTON_PRESS,
+	// Button was held for the long press time, sent once per press
+	BUTTON_LONG_PRESS,
+	// Button came back up
+	BUTTON_RELEASE,
+} button_action_t;
+
+typedef struct
+{
+	button_t button;
+	button_action_t action;
+} button_event_t;
+
+void button_init(void);
+uint8_t button_event_pop(button_event_t *event);
+uint8_t button_pressed(button_t button);
+uint16_t button_events_dropped(void);
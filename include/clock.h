@@ -1,8 +1,19 @@
 #pragma once
 
+// Timer 1 runs at 16MHz / 8 = 2MHz => 0.5us per tick
+#define CLOCK_TICK_HZ (F_CPU / 8)
+#define CLOCK_TICKS_PER_US (CLOCK_TICK_HZ / 1000000UL)
+
+typedef void (*clock_tick_t)(void);
+
 void clock_init(void);
 void delay_ms(uint32_t ms);
 void delay_us(uint32_t us);
+void delay_until(uint32_t ticks);
 
 uint32_t millis(void);
 uint32_t micros(void);
+uint64_t micros64(void);
+uint32_t clock_ticks(void);
+
+void clock_set_tick(clock_tick_t callback);
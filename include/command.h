@@ -0,0 +1,3 @@
+#pragma once
+
+void command_poll(void);
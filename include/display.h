@@ -3,3 +3,4 @@
 void display_init(void);
 void display_update(int32_t value);
 void display_clear(void);
+void display_refresh(void);
@@ -1,4 +1,23 @@
 #pragma once
 
+// A single count from the encoder
+//   time => micros() when the count was seen
+//   delta => +1 or -1
+typedef struct
+{
+	uint32_t time;
+	int8_t delta;
+} encoder_event_t;
+
+typedef void (*encoder_callback_t)(int8_t delta);
+
 void encoder_init(void);
-int8_t encoder_read(void);
+int16_t encoder_read(void);
+uint16_t encoder_count(void);
+uint16_t encoder_errors(void);
+uint16_t encoder_noise(void);
+void encoder_reset_stats(void);
+uint8_t encoder_event_pop(encoder_event_t *event);
+uint16_t encoder_events_dropped(void);
+int32_t encoder_velocity(void);
+void encoder_set_callback(encoder_callback_t callback);
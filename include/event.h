@@ -0,0 +1,16 @@
+#pragma once
+
+// Event flags, posted from interrupts and handled by the main loop
+//   Tick => Timer 0 millisecond tick
+//   Encoder => Encoder counted
+//   Button => Button event queued
+//   Stepper => Step generator took a segment or went idle,
+//     the step queue has room again
+#define EVENT_TICK (1 << 0)
+#define EVENT_ENCODER (1 << 1)
+#define EVENT_BUTTON (1 << 2)
+#define EVENT_STEPPER (1 << 3)
+
+void event_init(void);
+void event_post(uint8_t events);
+uint8_t event_wait(void);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+// Position in 0.0001" as the 8 display characters, a sign
+//   then the digits right aligned, not terminated
+//   "   0.0042" without the decimal point is "   00042"
+void format_position(int32_t value, char *digits);
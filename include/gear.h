@@ -0,0 +1,17 @@
+#pragma once
+
+typedef struct
+{
+	// Step pulses per position count, as a fraction
+	//   For example 127/25 => 5.08 steps per count
+	uint16_t numerator;
+	uint16_t denominator;
+} gear_ratio_t;
+
+void gear_init(const gear_ratio_t *ratio);
+uint8_t gear_is_valid(const gear_ratio_t *ratio);
+void gear_set_ratio(const gear_ratio_t *ratio);
+void gear_get_ratio(gear_ratio_t *ratio);
+uint16_t gear_max_input(void);
+int16_t gear_convert(int16_t counts);
+void gear_commit(void);
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "reg.h"
+
 typedef enum
 {
 	D0,		// PD0 (RX)
@@ -11,8 +16,8 @@ typedef enum
 	D6,		// PD6
 	D7,		// PD7
 	D8,		// PB0
-	D9,		// PB1
-	D10,	// PB2
+	D9,		// PB1 (OC1A)
+	D10,	// PB2 (OC1B)
 	D11,	// PB3 (MOSI)
 	D12,	// PB4 (MISO)
 	D13,	// PB5 (SCK)
@@ -37,7 +42,70 @@ typedef enum
 	VAL_HIGH = 1,
 } gpio_value_t;
 
+// Registers and bit mask for a pin
+//   These fold to constants when the pin is known at compile time
+#define GPIO_DDR(gpio) (((gpio) <= D7) ? &DDRD : (((gpio) <= D13) ? &DDRB : &DDRC))
+#define GPIO_PORT(gpio) (((gpio) <= D7) ? &PORTD : (((gpio) <= D13) ? &PORTB : &PORTC))
+#define GPIO_PIN(gpio) (((gpio) <= D7) ? &PIND : (((gpio) <= D13) ? &PINB : &PINC))
+#define GPIO_BIT(gpio) ((uint8_t)(1 << (((gpio) <= D7) ? (gpio) : (((gpio) <= D13) ? ((gpio) - D8) : ((gpio) - A0)))))
+
 void gpio_direction(gpio_t gpio, gpio_direction_t direction);
-void gpio_set_value(gpio_t gpio, gpio_value_t value);
-gpio_value_t gpio_get_value(gpio_t gpio);
-void gpio_toggle(gpio_t gpio);
+void gpio_set_value_runtime(gpio_t gpio, gpio_value_t value);
+gpio_value_t gpio_get_value_runtime(gpio_t gpio);
+void gpio_toggle_runtime(gpio_t gpio);
+
+// Pin access is inlined so a constant pin compiles down to a single
+//   sbi/cbi/sbic instruction, which is atomic and needs no interrupt
+//   masking. Pins only known at runtime use the functions in gpio.c
+
+static inline __attribute__((always_inline)) void gpio_set_value(gpio_t gpio, gpio_value_t value)
+{
+	// If the pin is known at compile time,
+	if (__builtin_constant_p(gpio))
+	{
+		if (value == VAL_HIGH)
+		{
+			// Set output bit
+			*GPIO_PORT(gpio) |= GPIO_BIT(gpio);
+		}
+		else
+		{
+			// Clear output bit
+			*GPIO_PORT(gpio) &= (uint8_t)~GPIO_BIT(gpio);
+		}
+	}
+	else
+	{
+		gpio_set_value_runtime(gpio, value);
+	}
+}
+
+static inline __attribute__((always_inline)) gpio_value_t gpio_get_value(gpio_t gpio)
+{
+	// If the pin is known at compile time,
+	if (__builtin_constant_p(gpio))
+	{
+		if ((*GPIO_PIN(gpio) & GPIO_BIT(gpio)) != 0)
+		{
+			return VAL_HIGH;
+		}
+
+		return VAL_LOW;
+	}
+
+	return gpio_get_value_runtime(gpio);
+}
+
+static inline __attribute__((always_inline)) void gpio_toggle(gpio_t gpio)
+{
+	// If the pin is known at compile time,
+	if (__builtin_constant_p(gpio))
+	{
+		// Writing a 1 to the input register toggles the output
+		REG_WRITE(*GPIO_PIN(gpio), GPIO_BIT(gpio));
+	}
+	else
+	{
+		gpio_toggle_runtime(gpio);
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// Rate the profile periods are counted in, matches the
+//   Timer 1 clock used by the step generator
+#define PROFILE_TICK_HZ 2000000UL
+
+typedef struct
+{
+	// Step rate at the start and end of every move, in steps/s
+	uint32_t start_rate;
+	// Step rate at the top of the ramp, in steps/s
+	//   Set equal to start_rate to disable the ramp
+	uint32_t max_rate;
+	// Change in step rate, in steps/s^2
+	uint32_t accel;
+} profile_config_t;
+
+void profile_init(const profile_config_t *config);
+void profile_start(void);
+uint16_t profile_next(uint16_t remaining);
+uint16_t profile_ramp(void);
@@ -0,0 +1,35 @@
+#pragma once
+
+typedef struct
+{
+	// Number of steps, the sign sets the direction
+	int16_t steps;
+	// Shortest step period in timer counts, 0 for no limit
+	uint16_t period;
+} segment_t;
+
+typedef struct
+{
+	// Most segments that were waiting at once
+	uint8_t high_water;
+	// Pushes rejected because the queue was full
+	uint16_t overflows;
+	// Pushes merged into the segment before them
+	uint16_t merges;
+} queue_stats_t;
+
+// Producer side, main loop only, the encoder interrupt only
+//   moves the position and the main loop queues the steps
+uint8_t queue_push(int16_t steps, uint16_t period);
+void queue_flush(void);
+uint8_t queue_pending(void);
+
+// Consumer side, step generator ISR only
+uint8_t queue_pop(segment_t *segment);
+int16_t queue_peek(void);
+// Steps waiting in the same direction, up to needed
+uint16_t queue_ahead(uint8_t negative, uint16_t needed);
+
+uint8_t queue_count(void);
+void queue_stats(queue_stats_t *stats);
+void queue_reset_stats(void);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <avr/io.h>
+
+// Write a register where the write itself does something, a flag
+//   clear, a PINx toggle or a data register that starts a transfer
+//   e.g. REG_WRITE(TIFR1, (1 << OCF1A))
+//   A plain store on the part, the host build's avr/io.h defines
+//   it first to hand the write to the simulator
+#ifndef REG_WRITE
+	#define REG_WRITE(reg, value) ((reg) = (value))
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "stepper.h"
+#include "gear.h"
+#include "profile.h"
+
+// Everything that can be tuned over the UART
+typedef struct
+{
+	stepper_timing_t timing;
+	gear_ratio_t gear;
+	profile_config_t profile;
+	// Increment for each position count in 0.0001"
+	uint8_t increment_fine;
+	uint8_t increment_coarse;
+	// Set to count counter-clockwise turns as positive
+	uint8_t encoder_reverse;
+	// Set to drive the direction output low for positive steps
+	uint8_t direction_low;
+} settings_t;
+
+uint8_t settings_init(settings_t *settings);
+uint8_t settings_get(const char *name, uint32_t *value);
+uint8_t settings_set(const char *name, uint32_t value);
+void settings_defaults(void);
+uint8_t settings_pending(void);
+uint8_t settings_take(settings_t *settings);
+uint8_t settings_save(void);
+uint8_t settings_save_next(void);
+void settings_dump_start(void);
+void settings_dump_next(void);
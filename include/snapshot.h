@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+// Lock-free reads of values an ISR writes
+//   An ISR runs to completion between two instructions of the
+//   main loop, so a multi-byte read can only be torn by an ISR
+//   running in the middle of it. Reading until two reads in a
+//   row agree gives a value the ISR actually wrote, without
+//   masking interrupts. The loop only repeats if the ISR ran
+//   during the read, so it ends within one extra pass
+//   Only for values with a single writer, a value the main loop
+//   also writes still needs interrupts disabled for the write
+
+// Keep the compiler from moving memory accesses across this point,
+//   for data handed between an ISR and the main loop through an
+//   index or flag
+#define barrier() __asm__ __volatile__ ("" ::: "memory")
+
+static inline uint16_t snapshot16(const volatile uint16_t *value)
+{
+	uint16_t a;
+
+	do
+	{
+		a = *value;
+	} while (a != *value);
+
+	return a;
+}
+
+static inline uint32_t snapshot32(const volatile uint32_t *value)
+{
+	uint32_t a;
+
+	do
+	{
+		a = *value;
+	} while (a != *value);
+
+	return a;
+}
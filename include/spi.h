@@ -2,6 +2,19 @@
 
 #include "gpio.h"
 
+// SPI backends
+//   Software => Bit bang any three pins, blocks until sent
+//   Hardware => SPI peripheral at 4MHz, frames are queued and
+//     sent from the SPI interrupt
+//     SCK must be D13 and MOSI must be D11, D10 (SS) is
+//     always an output so it is best used as CS
+//   Can be picked from the build, make test runs both
+#define SPI_SOFTWARE 0
+#define SPI_HARDWARE 1
+#ifndef SPI_BACKEND
+	#define SPI_BACKEND SPI_SOFTWARE
+#endif
+
 typedef struct
 {
 	gpio_t cs;
@@ -11,3 +24,4 @@ typedef struct
 
 void spi_init(spi_t spi);
 void spi_write(spi_t spi, uint8_t *data, uint8_t length);
+uint8_t spi_busy(void);
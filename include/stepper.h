@@ -0,0 +1,34 @@
+#pragma once
+
+#include "gpio.h"
+#include "clock.h"
+
+// Shortest phase the step ISR can reliably schedule,
+//   in timer counts
+#define STEPPER_MIN_TICKS 8
+// Fastest step rate in steps/s, each step is a high and
+//   a low phase of at least STEPPER_MIN_TICKS
+#define STEPPER_MAX_RATE (CLOCK_TICK_HZ / (2 * STEPPER_MIN_TICKS))
+
+typedef struct
+{
+	// Step pulse high time, the low time is the same
+	//   for a 50% duty cycle
+	uint16_t pulse_us;
+	// Time between setting the direction output and
+	//   the first step pulse
+	uint16_t setup_us;
+	// Extra low time after every group of step pulses
+	//   Set to 0 to disable
+	uint16_t dwell_us;
+	// Number of step pulses between each dwell
+	uint8_t group;
+} stepper_timing_t;
+
+void stepper_init(const stepper_timing_t *timing);
+void stepper_set_timing(const stepper_timing_t *timing);
+uint8_t stepper_move(uint16_t steps, gpio_value_t direction, uint32_t rate);
+void stepper_update(void);
+uint16_t stepper_remaining(void);
+uint16_t stepper_steps(void);
+uint8_t stepper_busy(void);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef void (*task_handler_t)(void);
+
+typedef struct
+{
+	// Name for the stats dump
+	const char *name;
+	// Run every period_ms milliseconds, from the deadline it was
+	//   due rather than when it last ran, so it never drifts
+	uint16_t period_ms;
+	// First run is phase_ms after the first tick, to keep tasks
+	//   with related periods from all landing on the same tick
+	uint16_t phase_ms;
+	// When more than one task is due, lower runs first
+	uint8_t priority;
+	task_handler_t handler;
+} task_config_t;
+
+typedef struct
+{
+	// Times the handler ran
+	uint16_t runs;
+	// Deadlines skipped because the task was a whole period late
+	uint16_t missed;
+	// Longest time from the deadline to the handler starting,
+	//   in milliseconds
+	uint16_t latency_max_ms;
+	// Handler run time, in microseconds
+	uint16_t run_max_us;
+	uint32_t run_total_us;
+} task_stats_t;
+
+void task_init(const task_config_t *tasks, uint8_t count);
+void task_run(void);
+uint16_t task_pass_max(void);
+void task_get_stats(uint8_t index, task_stats_t *stats);
+void task_reset(void);
+void task_dump_start(void);
+void task_dump_next(void);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+// Set to 0 to leave the telemetry stream out
+#define TELEMETRY_ENABLE 0
+
+// Samples per second, up to 1000 and a divisor of 1000 so the
+//   task period comes out in whole milliseconds
+//   Each frame is TELEMETRY_FRAME_SIZE (25) bytes, 10 bits each on
+//   the wire, 100Hz fits in 115200 baud with room for printf()
+//   text, 1000Hz needs UART_BAUD at 500000, 250000 would be full
+//   with frames alone
+#define TELEMETRY_RATE_HZ 100
+
+_Static_assert((1000 % TELEMETRY_RATE_HZ) == 0, "TELEMETRY_RATE_HZ must divide 1000");
+
+// Bumped whenever telemetry_sample_t changes
+#define TELEMETRY_VERSION 1
+
+// One sample, sent as-is in AVR byte order (little endian)
+//   Frame on the wire:
+//   0x00, COBS(sample, CRC low, CRC high), 0x00
+//   The leading 0x00 ends any printf() text sent in between,
+//   so the decoder starts every frame clean
+typedef struct __attribute__((packed))
+{
+	// TELEMETRY_VERSION
+	uint8_t version;
+	// Counts up every sample, a gap means frames were dropped
+	uint8_t sequence;
+	// micros() when the sample was taken
+	uint32_t time_us;
+	// Position in 0.0001", before any work offset
+	int32_t position;
+	// Encoder counts since the last sample
+	int16_t encoder_delta;
+	// Step segments waiting in the queue
+	uint8_t queue_depth;
+	// Step pulses per second since the last sample
+	uint16_t step_rate;
+	// Longest pass through the main loop tasks since the
+	//   last sample, in microseconds
+	uint16_t loop_max_us;
+	// Frames not sent because the UART buffer was full
+	uint16_t dropped;
+} telemetry_sample_t;
+
+#define TELEMETRY_CRC_SIZE 2
+// COBS adds one byte for every 254, plus the two delimiters
+#define TELEMETRY_FRAME_SIZE (sizeof(telemetry_sample_t) + TELEMETRY_CRC_SIZE + 3)
+
+// CRC-16/CCITT-FALSE, start from 0xFFFF
+static inline uint16_t telemetry_crc(uint16_t crc, const uint8_t *data, uint8_t length)
+{
+	for (uint8_t i = 0; i < length; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = ((crc & 0x8000) != 0) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+void telemetry_init(void);
+void telemetry_send(int32_t position);
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "gpio.h"
+
+// Set to 0 to compile every trace point to nothing
+#define TRACE_ENABLE 0
+
+// Trace outputs
+//   RAM => Time each trace point with timer 1, keep count,
+//     min/max/avg and how often an interrupt got in the way,
+//     plus the most recent calls in a ring buffer
+//     Dumped over the UART with trace_dump_start()
+//   GPIO => Drive a debug pin high for as long as each trace
+//     point runs, for a logic analyzer
+#define TRACE_RAM 0
+#define TRACE_GPIO 1
+#define TRACE_OUTPUT TRACE_RAM
+
+// Interrupts first, trace_end() counts them to tell when
+//   a main loop trace point was interrupted
+typedef enum
+{
+	TRACE_INT0,
+	TRACE_INT1,
+	TRACE_TIMER0,
+	TRACE_TIMER1,
+	TRACE_TIMER2,
+	TRACE_OUTPUT_STEPS,
+	TRACE_DISPLAY,
+	TRACE_SPI,
+	TRACE_COUNT,
+} trace_point_t;
+
+#define TRACE_ISR_COUNT TRACE_OUTPUT_STEPS
+
+#if (TRACE_ENABLE != 0) && (TRACE_OUTPUT == TRACE_RAM)
+
+typedef struct
+{
+	// Timer 1 count when the trace point started
+	uint16_t start;
+	// Interrupt trace points finished before it started
+	uint8_t isr_count;
+} trace_mark_t;
+
+extern volatile uint8_t trace_isr_count;
+
+static inline __attribute__((always_inline)) trace_mark_t trace_begin(void)
+{
+	trace_mark_t mark = {TCNT1, trace_isr_count};
+
+	return mark;
+}
+
+void trace_init(void);
+void trace_end(trace_point_t point, trace_mark_t mark);
+void trace_reset(void);
+void trace_dump_start(void);
+void trace_dump_next(void);
+
+#define TRACE_BEGIN(point) trace_mark_t trace_mark_##point = trace_begin()
+#define TRACE_END(point) trace_end(point, trace_mark_##point)
+
+#elif (TRACE_ENABLE != 0) && (TRACE_OUTPUT == TRACE_GPIO)
+
+// Debug pin for each trace point, D7, D8 and A2-A5 are free
+//   TRACE_NO_PIN leaves a trace point out
+#define TRACE_NO_PIN 0xFF
+
+static const uint8_t trace_pins[TRACE_COUNT] __attribute__((unused)) =
+{
+	D7,				// TRACE_INT0
+	D8,				// TRACE_INT1
+	A2,				// TRACE_TIMER0
+	A3,				// TRACE_TIMER1
+	TRACE_NO_PIN,	// TRACE_TIMER2
+	A4,				// TRACE_OUTPUT_STEPS
+	A5,				// TRACE_DISPLAY
+	TRACE_NO_PIN,	// TRACE_SPI
+};
+
+void trace_init(void);
+
+// The pin folds to a constant, so each edge is a single sbi/cbi
+#define TRACE_BEGIN(point) \
+	do { if (trace_pins[point] != TRACE_NO_PIN) { gpio_set_value((gpio_t)trace_pins[point], VAL_HIGH); } } while (0)
+#define TRACE_END(point) \
+	do { if (trace_pins[point] != TRACE_NO_PIN) { gpio_set_value((gpio_t)trace_pins[point], VAL_LOW); } } while (0)
+
+#else
+
+#define TRACE_BEGIN(point) do { } while (0)
+#define TRACE_END(point) do { } while (0)
+
+#endif
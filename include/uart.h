@@ -1,3 +1,18 @@
 #pragma once
 
+#include <stdio.h>
+
+// Room to wait for in the transmit buffer before printing each
+//   line of a dump, so the dump doesn't drop characters
+#define UART_LINE_SIZE 48
+
 void uart_init(uint32_t baud);
+int uart_putchar(char c, FILE *stream);
+// Points stdout at uart_putchar(), kept in its own file
+//   so the host build can put its own in place
+void uart_stdout_init(void);
+uint16_t uart_tx_dropped(void);
+uint16_t uart_rx_dropped(void);
+uint8_t uart_tx_free(void);
+uint8_t uart_write(const uint8_t *data, uint8_t length);
+int16_t uart_read(void);
@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "button.h"
+#include "gpio.h"
+#include "clock.h"
+#include "event.h"
+#include "snapshot.h"
+
+// Configure to use input pullups on the buttons
+//   The buttons are active low
+#define PULLUP_ENABLE 0
+
+// The buttons share the PCINT2 pin change interrupt, so they
+//   must all be on port D (D0-D7), in button_t order
+static const gpio_t pins[BUTTON_COUNT] = {D4, D5, D6};
+
+// A new level has to hold this long to be accepted, in milliseconds
+#define DEBOUNCE_MS 10
+// Time a button has to be held for a long press, in milliseconds
+#define LONG_PRESS_MS 1000
+
+// Size of the event buffer, must be a power of 2
+#define EVENT_COUNT 8
+#define EVENT_MASK (EVENT_COUNT - 1)
+
+// PIND bits of all buttons
+static uint8_t mask = 0;
+// Debounced state, a set bit is a pressed button
+static uint8_t pressed = 0;
+// Milliseconds each button has read different from its
+//   debounced state, or has been held down
+static uint8_t settle[BUTTON_COUNT];
+static uint16_t held[BUTTON_COUNT];
+// Set by a pin change, cleared once every button is
+//   released and settled so the tick has nothing to do
+static volatile uint8_t active = 0;
+
+// Only the tick moves tail and only button_event_pop() moves head
+static button_event_t events[EVENT_COUNT];
+static volatile uint8_t event_head = 0;
+static volatile uint8_t event_tail = 0;
+static volatile uint16_t events_dropped = 0;
+
+static void push(button_t button, button_action_t action)
+{
+	uint8_t t = event_tail;
+
+	// If the reader has fallen behind,
+	if ((uint8_t)(t - event_head) >= EVENT_COUNT)
+	{
+		// Drop the event
+		events_dropped += 1;
+
+		return;
+	}
+
+	events[t & EVENT_MASK].button = button;
+	events[t & EVENT_MASK].action = action;
+	// The event must be written before the reader can see it
+	barrier();
+	event_tail = t + 1;
+
+	event_post(EVENT_BUTTON);
+}
+
+static void tick(void)
+{
+	// If nothing is pressed or bouncing,
+	if (active == 0)
+	{
+		// Nothing to do here
+		return;
+	}
+
+	// Buttons are active low
+	uint8_t raw = ~PIND & mask;
+	uint8_t busy = 0;
+
+	for (uint8_t i = 0; i < BUTTON_COUNT; i++)
+	{
+		uint8_t bit = GPIO_BIT(pins[i]);
+
+		// If the pin reads the same as the debounced state,
+		if ((raw & bit) == (pressed & bit))
+		{
+			// Any bounce is over
+			settle[i] = 0;
+		}
+		// Otherwise wait for the new level to hold
+		else if (++settle[i] >= DEBOUNCE_MS)
+		{
+			settle[i] = 0;
+			held[i] = 0;
+			pressed ^= bit;
+
+			push((button_t)i, ((pressed & bit) != 0) ? BUTTON_PRESS : BUTTON_RELEASE);
+		}
+
+		if ((pressed & bit) != 0)
+		{
+			// Count up to the long press once
+			if (held[i] < LONG_PRESS_MS)
+			{
+				held[i] += 1;
+
+				if (held[i] == LONG_PRESS_MS)
+				{
+					push((button_t)i, BUTTON_LONG_PRESS);
+				}
+			}
+
+			busy = 1;
+		}
+
+		if (settle[i] != 0)
+		{
+			busy = 1;
+		}
+	}
+
+	active = busy;
+}
+
+void button_init(void)
+{
+	mask = 0;
+
+	for (uint8_t i = 0; i < BUTTON_COUNT; i++)
+	{
+		#if PULLUP_ENABLE != 0
+			// Set as input with internal pullup
+			gpio_direction(pins[i], DIR_INPUT_PULLUP);
+		#else
+			// Set as input with no pullup
+			gpio_direction(pins[i], DIR_INPUT);
+		#endif
+
+		mask |= GPIO_BIT(pins[i]);
+		settle[i] = 0;
+		held[i] = 0;
+	}
+
+	pressed = 0;
+	// Let the first tick pick up any button already held down
+	active = 1;
+
+	// Enable pin change interrupts on the buttons
+	PCMSK2 |= mask;
+	PCICR |= (1 << PCIE2);
+
+	// Debounce from the millisecond timer
+	clock_set_tick(tick);
+}
+
+uint8_t button_event_pop(button_event_t *event)
+{
+	uint8_t h = event_head;
+
+	// If there are no events,
+	if (h == event_tail)
+	{
+		// Nothing to do here
+		return 0;
+	}
+
+	// Only read the event after seeing it was queued
+	barrier();
+	*event = events[h & EVENT_MASK];
+	// The event must be copied before the tick can reuse the slot
+	barrier();
+	event_head = h + 1;
+
+	return 1;
+}
+
+uint8_t button_pressed(button_t button)
+{
+	return (pressed & GPIO_BIT(pins[button])) != 0;
+}
+
+uint16_t button_events_dropped(void)
+{
+	return snapshot16(&events_dropped);
+}
+
+// Pin Change Interrupt 2 (D0-D7)
+ISR(PCINT2_vect)
+{
+	// Any edge starts the debounce, the tick does the rest
+	active = 1;
+}
@@ -1,11 +1,19 @@
 #include <stdint.h>
+#include <stddef.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
 #include "clock.h"
+#include "event.h"
+#include "trace.h"
+#include "snapshot.h"
 
 static volatile uint32_t timer0_millis = 0;
+// Number of times timer 1 has wrapped around
+static volatile uint32_t timer1_overflows = 0;
+// Called from the timer interrupt every millisecond
+static clock_tick_t tick = NULL;
 
 void clock_init(void)
 {
@@ -16,11 +24,42 @@ void clock_init(void)
 	// Set timer 0 clock prescale factor to 64
 	TCCR0B |= (1 << CS01) | (1 << CS00);
 
-	// Set timer 0 compare to 250 => 16MHz / 64 / 250 = 1kHz
-	OCR0A = 250;
+	// Set timer 0 compare to 249 => 16MHz / 64 / (249 + 1) = 1kHz
+	OCR0A = 249;
 
 	// Enable timer 0 compare interrupt
 	TIMSK0 |= (1 << OCIE0A);
+
+	// Set timer 1 to Normal mode, free running from 0 to 0xFFFF
+	//   The step generator schedules its compares on this count
+	TCCR1A = 0;
+	TCNT1 = 0;
+
+	// Set timer 1 clock prescale factor to 8 => 0.5us per count
+	TCCR1B = (1 << CS11);
+
+	// Enable timer 1 overflow interrupt
+	TIMSK1 |= (1 << TOIE1);
+}
+
+static uint16_t read_count(void)
+{
+	// Reading the low byte of TCNT1 latches the high byte in a
+	//   temporary register the ISRs share when they touch any
+	//   timer 1 register, so the two byte reads can't be split
+	//   by an interrupt
+
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts
+	cli();
+
+	uint16_t count = TCNT1;
+
+	// Restore CPU flags
+	SREG = sreg;
+
+	return count;
 }
 
 void delay_ms(uint32_t ms)
@@ -43,62 +82,139 @@ void delay_us(uint32_t us)
 		return;
 	}
 
-	// Magic incantation from Arduino @ 16MHz
-	us = (us << 2) - 1;
-
-	// Spinlock
-	__asm__ __volatile__
-	(
-		"1:"			"\n\t"	// Create a label called 1
-		"sbiw %0,1"		"\n\t"	// us -= 1
-		"brne 1b"				// if (us != 0) goto 1
-		: "=w" (us)
-		: "0" (us)
-	);
+	// Count timer 1 ticks as they go by rather than reading the
+	//   full timebase, so this works with interrupts disabled and
+	//   interrupts that come in don't stretch the delay
+	uint32_t left = us * CLOCK_TICKS_PER_US;
+	uint16_t last = read_count();
+
+	while (1)
+	{
+		uint16_t now = read_count();
+		uint16_t passed = now - last;
+
+		// If the time is up,
+		if (passed >= left)
+		{
+			return;
+		}
+
+		left -= passed;
+		last = now;
+	}
 }
 
-uint32_t millis(void)
+void delay_until(uint32_t ticks)
 {
-	// Disable interrupts because a uint32_t takes
-	//   multiple instructions to copy and we don't
-	//   want the timer to update mid-copy
+	// Signed difference so the deadline can be on the
+	//   other side of the count wrapping around
+	while ((int32_t)(ticks - clock_ticks()) > 0)
+	{
+		// Spinlock
+	}
+}
 
-	// Copy CPU flags
-	uint8_t sreg = SREG;
-	// Disable interrupts
-	cli();
+static void read_timer1(uint32_t *high, uint16_t *low)
+{
+	uint32_t overflows;
+	uint16_t count;
+	uint8_t pending;
+
+	// No interrupts are disabled, if the overflow interrupt runs
+	//   during the read the count of overflows changes and the
+	//   read starts over
+	do
+	{
+		overflows = timer1_overflows;
+		count = read_count();
+		pending = (TIFR1 & (1 << TOV1)) != 0;
+	} while (overflows != timer1_overflows);
+
+	// If the timer wrapped around but the overflow interrupt
+	//   hasn't run yet, the count is already past the overflow
+	//   This only happens with interrupts disabled, as in an ISR
+	//   The count is checked too, in case the flag was set
+	//   just after it was read
+	if ((pending != 0) && (count < 0x8000))
+	{
+		overflows += 1;
+	}
 
-	// Copy milliseconds counter
-	uint32_t m = timer0_millis;
+	*high = overflows;
+	*low = count;
+}
 
-	// Restore CPU flags
-	SREG = sreg;
+uint32_t clock_ticks(void)
+{
+	uint32_t high;
+	uint16_t low;
+
+	read_timer1(&high, &low);
+
+	return (high << 16) | low;
+}
 
-	return m;
+uint32_t millis(void)
+{
+	// A uint32_t takes multiple instructions to copy, so read
+	//   it until the timer interrupt didn't update it mid-copy
+	return snapshot32(&timer0_millis);
 }
 
 uint32_t micros(void)
+{
+	uint32_t high;
+	uint16_t low;
+
+	read_timer1(&high, &low);
+
+	// Each overflow is 65536 ticks => 32768us
+	return (high << 15) + (low / CLOCK_TICKS_PER_US);
+}
+
+uint64_t micros64(void)
+{
+	uint32_t high;
+	uint16_t low;
+
+	read_timer1(&high, &low);
+
+	return ((uint64_t)high << 15) + (low / CLOCK_TICKS_PER_US);
+}
+
+void clock_set_tick(clock_tick_t callback)
 {
 	// Copy CPU flags
 	uint8_t sreg = SREG;
 	// Disable interrupts
 	cli();
 
-	// Convert to microseconds
-	uint32_t us = timer0_millis * 1000;
-
-	// Each timer count is 4us => 1kHz / 250 = 4us
-	us += TCNT0 * 4;
+	tick = callback;
 
 	// Restore CPU flags
 	SREG = sreg;
-
-	return us;
 }
 
 // Timer 0 Compare Interrupt
 ISR(TIMER0_COMPA_vect)
 {
+	TRACE_BEGIN(TRACE_TIMER0);
+
 	// Increment milliseconds value at 1kHz
 	timer0_millis += 1;
+	event_post(EVENT_TICK);
+
+	if (tick != NULL)
+	{
+		tick();
+	}
+
+	TRACE_END(TRACE_TIMER0);
+}
+
+// Timer 1 Overflow Interrupt
+ISR(TIMER1_OVF_vect)
+{
+	// Extend the 16 bit count
+	timer1_overflows += 1;
 }
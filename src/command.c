@@ -0,0 +1,228 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+#include "uart.h"
+#include "queue.h"
+#include "encoder.h"
+#include "settings.h"
+#include "task.h"
+#include "trace.h"
+
+// Longest command line, including the terminator
+#define LINE_SIZE 32
+
+// Commands over the UART, one per line
+//   get => List every setting
+//   get name => Print one setting
+//   set name value => Change a setting, the main loop applies
+//     the changes together once the stepper is idle
+//   save => Save the settings to EEPROM, loaded at startup,
+//     the write goes on in the background
+//   defaults => Go back to the settings built into the firmware
+//   s => Dump the step queue, encoder and task stats
+//   t => Dump the trace stats and recent calls
+//   r => Reset the stats
+
+static char line[LINE_SIZE];
+static uint8_t length = 0;
+// Set when the line didn't fit, it is thrown away
+static uint8_t overflow = 0;
+// Next line of the stats dump, 0 when there is none running
+static uint8_t stats_line = 0;
+
+static void handle_get(const char *name)
+{
+	uint32_t value;
+
+	// With no name, list them all
+	if (name == NULL)
+	{
+		settings_dump_start();
+	}
+	else if (settings_get(name, &value) != 0)
+	{
+		printf("%s %lu\n", name, (unsigned long)value);
+	}
+	else
+	{
+		printf("Unknown Setting\n");
+	}
+}
+
+static void handle_set(const char *name, const char *text)
+{
+	uint32_t value;
+
+	if ((name == NULL) || (text == NULL) || (settings_get(name, &value) == 0))
+	{
+		printf("Unknown Setting\n");
+
+		return;
+	}
+
+	char *end;
+
+	value = strtoul(text, &end, 0);
+
+	if ((*end != '\0') || (settings_set(name, value) == 0))
+	{
+		printf("Bad Value\n");
+
+		return;
+	}
+
+	printf("%s %lu Pending\n", name, (unsigned long)value);
+}
+
+static void stats_next(void)
+{
+	// If there is no dump running or the UART is still busy
+	//   with the last line,
+	if ((stats_line == 0) || (uart_tx_free() < UART_LINE_SIZE))
+	{
+		// Nothing to do here
+		return;
+	}
+
+	uint8_t line = stats_line - 1;
+
+	stats_line += 1;
+
+	if (line == 0)
+	{
+		queue_stats_t q;
+
+		queue_stats(&q);
+		printf("queue: high %u overflows %u merges %u\n", q.high_water, q.overflows, q.merges);
+
+		return;
+	}
+
+	// Impossible transitions the decoder dropped, and pulses
+	//   too short to get through the glitch filter
+	if (line == 1)
+	{
+		printf("encoder: errors %u noise %u\n", encoder_errors(), encoder_noise());
+
+		return;
+	}
+
+	// The task table follows
+	stats_line = 0;
+	task_dump_start();
+}
+
+static void run(char *text)
+{
+	char *command = strtok(text, " ");
+	char *name = strtok(NULL, " ");
+	char *value = strtok(NULL, " ");
+
+	// Blank line
+	if (command == NULL)
+	{
+		return;
+	}
+
+	if (strcmp(command, "get") == 0)
+	{
+		handle_get(name);
+	}
+	else if (strcmp(command, "set") == 0)
+	{
+		handle_set(name, value);
+	}
+	else if (strcmp(command, "save") == 0)
+	{
+		// Settings Saved is printed once the last byte is written
+		if (settings_save() == 0)
+		{
+			printf("Bad Settings, not saved\n");
+		}
+	}
+	else if (strcmp(command, "defaults") == 0)
+	{
+		settings_defaults();
+		printf("Defaults Pending\n");
+	}
+	else if (strcmp(command, "s") == 0)
+	{
+		stats_line = 1;
+	}
+	#if (TRACE_ENABLE != 0) && (TRACE_OUTPUT == TRACE_RAM)
+		else if (strcmp(command, "t") == 0)
+		{
+			trace_dump_start();
+		}
+	#endif
+	else if (strcmp(command, "r") == 0)
+	{
+		task_reset();
+		queue_reset_stats();
+		encoder_reset_stats();
+		#if (TRACE_ENABLE != 0) && (TRACE_OUTPUT == TRACE_RAM)
+			trace_reset();
+		#endif
+		printf("Stats Reset\n");
+	}
+	else
+	{
+		printf("Unknown Command\n");
+	}
+}
+
+void command_poll(void)
+{
+	int16_t c;
+
+	// Take in characters until a full line is in, only one
+	//   command runs per call so its reply has room to go out
+	while ((c = uart_read()) >= 0)
+	{
+		if ((c == '\r') || (c == '\n'))
+		{
+			// If the line fit,
+			if (overflow == 0)
+			{
+				line[length] = '\0';
+				length = 0;
+				run(line);
+
+				break;
+			}
+
+			printf("Line Too Long\n");
+			length = 0;
+			overflow = 0;
+
+			break;
+		}
+
+		if (length < (LINE_SIZE - 1))
+		{
+			line[length] = (char)c;
+			length += 1;
+		}
+		else
+		{
+			overflow = 1;
+		}
+	}
+
+	// Write a saved byte whenever the EEPROM is ready for one
+	if (settings_save_next() != 0)
+	{
+		printf("Settings Saved\n");
+	}
+
+	// Print the dumps a line at a time as the UART keeps up
+	settings_dump_next();
+	stats_next();
+	task_dump_next();
+	#if (TRACE_ENABLE != 0) && (TRACE_OUTPUT == TRACE_RAM)
+		trace_dump_next();
+	#endif
+}
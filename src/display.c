@@ -1,15 +1,23 @@
 #include <stdint.h>
-#include <stdio.h>
 #include <string.h>
 
 #include <avr/pgmspace.h>
 
 #include "spi.h"
 #include "display.h"
-
-#define CS_PIN 10
-#define SCK_PIN 11
-#define MOSI_PIN 12
+#include "format.h"
+#include "trace.h"
+
+#if SPI_BACKEND == SPI_HARDWARE
+	// SCK and MOSI are fixed by the SPI peripheral
+	#define CS_PIN D10
+	#define SCK_PIN D13
+	#define MOSI_PIN D11
+#else
+	#define CS_PIN 10
+	#define SCK_PIN 11
+	#define MOSI_PIN 12
+#endif
 
 // List of MAX7219 opcodes
 #define OP_NOOP 0
@@ -48,8 +56,12 @@ static const uint8_t table[] PROGMEM =
 	0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000
 };
 
-// Software SPI config struct to define pins
-static spi_t spi =
+// Segment patterns last written to each digit register,
+//   index 0 is OP_DIGIT0
+static uint8_t framebuffer[8] = {0};
+
+// SPI config struct to define pins
+static const spi_t spi =
 {
 	.cs = CS_PIN,
 	.sck = SCK_PIN,
@@ -83,15 +95,12 @@ static void display_write(uint8_t opcode, uint8_t data)
 	// Set user-supplied data
 	buffer[1] = data;
 
-	// Write 2 bytes over Software SPI
+	// Write 2 bytes over SPI
 	spi_write(spi, buffer, 2);
 }
 
-void display_init(void)
+static void display_configure(void)
 {
-	// Initialize software SPI
-	spi_init(spi);
-
 	// Disable display test mode
 	display_write(OP_DISPLAYTEST, 0x00);
 	// Configure to write up to 8 digits
@@ -100,6 +109,28 @@ void display_init(void)
 	display_write(OP_DECODEMODE, 0x00);
 	// Set maximum intensity
 	display_write(OP_INTENSITY, 0x0F);
+}
+
+static void display_digit(uint8_t digit, uint8_t value)
+{
+	// If the digit already shows this pattern,
+	if (framebuffer[digit] == value)
+	{
+		// Nothing to do here
+		return;
+	}
+
+	framebuffer[digit] = value;
+	display_write(OP_DIGIT0 + digit, value);
+}
+
+void display_init(void)
+{
+	// Initialize SPI
+	spi_init(spi);
+
+	// Setup display registers
+	display_configure();
 	// Clear display before enabling to clear garbage
 	display_clear();
 	// Enable display outputs
@@ -108,19 +139,10 @@ void display_init(void)
 
 void display_update(int32_t value)
 {
-	// ASCII buffer, 8 digits + null
-	static char digits[9] = {0};
-	// Assume value is positive, first digit is empty
-	char prefix = ' ';
+	TRACE_BEGIN(TRACE_DISPLAY);
 
-	// If value is negative,
-	if (value < 0)
-	{
-		// Set first digit to negative sign
-		prefix = '-';
-		// Ensure value is positive
-		value = -value;
-	}
+	// ASCII digits
+	char digits[8];
 
 	// Convert value to ASCII:
 	//  "   0.0042"
@@ -131,28 +153,31 @@ void display_update(int32_t value)
 	//  "- 20.0000"
 	//  " 123.4567"
 	//  "-123.4567"
-	// Format Specifiers:
-	// %c => Print character
-	// 0%04ld => Print 0.<value> padded to 4 with leading zeros
-	// %07ld => Print <value> padded to 7 with leading spaces
-	if (value < 10000)
-	{
-		// Special case:
-		//   Value is < 1", only display one zero to the left of the decimal point
-		snprintf(digits, sizeof(digits), "%c  0%04ld", prefix, value);
-	}
-	else
-	{
-		snprintf(digits, sizeof(digits), "%c%7ld", prefix, value);
-	}
+	format_position(value, digits);
 
 	// Digit opcode starts at 1
 	for (uint8_t i = 1; i <= 8; i++)
 	{
-		// Update all digits in display,
+		// Update changed digits in display,
 		//   with a decimal point at position 4
-		display_write(9 - i, get_value(digits[i - 1], i == 4));
+		display_digit(8 - i, get_value(digits[i - 1], i == 4));
+	}
+
+	TRACE_END(TRACE_DISPLAY);
+}
+
+void display_refresh(void)
+{
+	// Rewrite every register in case noise corrupted the
+	//   display, updates only send the digits that changed
+	display_configure();
+
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		display_write(OP_DIGIT0 + i, framebuffer[i]);
 	}
+
+	display_write(OP_SHUTDOWN, 0x01);
 }
 
 void display_clear(void)
@@ -161,6 +186,7 @@ void display_clear(void)
 	for (uint8_t i = 1; i <= 8; i++)
 	{
 		// Clear all segments from all digits
+		framebuffer[i - 1] = 0;
 		display_write(i, 0);
 	}
 }
@@ -1,19 +1,111 @@
 #include <stdint.h>
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 #include "encoder.h"
 #include "gpio.h"
 #include "clock.h"
+#include "event.h"
+#include "trace.h"
+#include "snapshot.h"
 
 // Configure to use input pullups on the A/B signals
 #define PULLUP_ENABLE 1
 
+// Counts per quadrature cycle
+//   1x => One count per cycle, one per detent on most
+//     mechanical encoders
+//   2x => Count every A edge
+//   4x => Count every A and B edge, for glass scales and
+//     high resolution handwheels
+#define RESOLUTION_1X 0
+#define RESOLUTION_2X 1
+#define RESOLUTION_4X 2
+#define RESOLUTION RESOLUTION_1X
+
+// Decoder modes
+//   Edge => INT0/INT1 interrupt on every edge of A and B, the
+//     lowest latency, but noise on the pins can cause an
+//     interrupt storm and phantom counts
+//   Sampled => Timer 2 samples A and B at SAMPLE_RATE_HZ through
+//     a glitch filter, the interrupt load stays the same no
+//     matter how noisy the pins get
+#define DECODER_EDGE 0
+#define DECODER_SAMPLED 1
+#define DECODER_MODE DECODER_EDGE
+
+// Timer 2 sample rate for the sampled decoder
+//   Needs a few samples per quadrature state at the fastest spin
+//   16MHz / 8 / 25kHz = 80 timer counts
+#define SAMPLE_RATE_HZ 25000UL
+// Integrator filter length for the sampled decoder
+//   A pin has to read a new level this many more times than
+//   the old one before the decoder sees the change, pulses
+//   shorter than this are counted as noise and dropped
+//   Each step adds 1 / SAMPLE_RATE_HZ of latency
+#define FILTER_SAMPLES 4
+
+// Both pins are read with a single PIND read,
+//   A must be D2 (PD2) and B must be D3 (PD3)
 #define A_PIN D2
 #define B_PIN D3
+#define AB_MASK 0x0C
+#define A_BIT 0x04
+#define B_BIT 0x08
+
+// Table entry for a transition where both pins changed
+#define ERR 2
+
+// Size of the event buffer, must be a power of 2
+#define EVENT_COUNT 16
+#define EVENT_MASK (EVENT_COUNT - 1)
+
+// Number of count timestamps the velocity is averaged over,
+//   must be a power of 2
+#define WINDOW_SIZE 8
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+// A gap longer than this starts the average over, in microseconds
+#define WINDOW_TIMEOUT_US 100000UL
 
 static uint8_t state = 0;
-static int8_t position = 0;
+// Only the ISR writes the count and only encoder_read() writes
+//   what it last read, so neither side has to disable interrupts
+static volatile uint16_t position = 0;
+static uint16_t position_read = 0;
+static volatile uint16_t errors = 0;
+// Counts at the last encoder_reset_stats(), the ISR's
+//   counters are never cleared so they need no interrupt lock
+static uint16_t errors_base = 0;
+
+#if DECODER_MODE == DECODER_SAMPLED
+	// Filtered A/B levels, in the same bits as PIND
+	static uint8_t filtered = 0;
+	// Integrator for each pin, 0 is low and FILTER_SAMPLES is high
+	static uint8_t integrator[2] = {0, 0};
+	// Set while a pin's integrator is away from its filtered level
+	static uint8_t unsettled = 0;
+	// Pulses the filter threw away
+	static volatile uint16_t noise = 0;
+	static uint16_t noise_base = 0;
+#endif
+
+// Only the ISR moves tail and only encoder_event_pop() moves head
+static encoder_event_t events[EVENT_COUNT];
+static volatile uint8_t event_head = 0;
+static volatile uint8_t event_tail = 0;
+static volatile uint16_t events_dropped = 0;
+
+// Timestamps of the last counts in the same direction
+//   The ISR bumps the sequence after each update, a reader
+//   that sees it change tries again
+static volatile uint8_t window_sequence = 0;
+static uint32_t window[WINDOW_SIZE];
+static uint8_t window_index = 0;
+static uint8_t window_count = 0;
+static int8_t window_direction = 0;
+static encoder_callback_t callback = NULL;
 
 //                           _______         _______
 //               Pin1 ______|       |_______|       |______ Pin1
@@ -21,56 +113,173 @@ static int8_t position = 0;
 //               Pin2 __|       |_______|       |_______|   Pin2
 
 //	new	new	old	old
-//	pin2	pin1	pin2	pin1	Result
-//	----	----	----	----	------
-//	0	0	0	0	no movement
-//	0	0	0	1	+1
-//	0	0	1	0	-1
-//	0	0	1	1	+2  (assume pin1 edges only)
-//	0	1	0	0	-1
-//	0	1	0	1	no movement
-//	0	1	1	0	-2  (assume pin1 edges only)
-//	0	1	1	1	+1
-//	1	0	0	0	+1
-//	1	0	0	1	-2  (assume pin1 edges only)
-//	1	0	1	0	no movement
-//	1	0	1	1	-1
-//	1	1	0	0	+2  (assume pin1 edges only)
-//	1	1	0	1	-1
-//	1	1	1	0	+1
-//	1	1	1	1	no movement
-static void update(void)
-{
-	// Get lower two bits of global state
-	uint8_t s = state & 0x03;
-
-	// Get the state of the A pin
-	if (gpio_get_value(A_PIN) == VAL_HIGH)
+//	pin2	pin1	pin2	pin1	4x	2x	1x
+//	----	----	----	----	--	--	--
+//	0	0	0	0	0	0	0
+//	0	0	0	1	+1	+1	0
+//	0	0	1	0	-1	0	0
+//	0	0	1	1	err	err	err
+//	0	1	0	0	-1	-1	0
+//	0	1	0	1	0	0	0
+//	0	1	1	0	err	err	err
+//	0	1	1	1	+1	0	0
+//	1	0	0	0	+1	0	0
+//	1	0	0	1	err	err	err
+//	1	0	1	0	0	0	0
+//	1	0	1	1	-1	-1	0
+//	1	1	0	0	err	err	err
+//	1	1	0	1	-1	0	-1
+//	1	1	1	0	+1	+1	+1
+//	1	1	1	1	0	0	0
+static const int8_t table[16] PROGMEM =
+{
+	#if RESOLUTION == RESOLUTION_4X
+		0, 1, -1, ERR, -1, 0, ERR, 1, 1, ERR, 0, -1, ERR, -1, 1, 0,
+	#elif RESOLUTION == RESOLUTION_2X
+		0, 1, 0, ERR, -1, 0, ERR, 0, 0, ERR, 0, -1, ERR, 0, 1, 0,
+	#else
+		// Only states E and D count, exactly 1 update per detent
+		0, 0, 0, ERR, 0, 0, ERR, 0, 0, ERR, 0, 0, ERR, -1, 1, 0,
+	#endif
+};
+
+static void record(uint32_t now, int8_t delta)
+{
+	uint8_t t = event_tail;
+
+	// Queue the event unless the reader has fallen behind
+	if ((uint8_t)(t - event_head) < EVENT_COUNT)
 	{
-		s |= 0x04;
+		events[t & EVENT_MASK].time = now;
+		events[t & EVENT_MASK].delta = delta;
+		// The event must be written before the reader can see it
+		barrier();
+		event_tail = t + 1;
 	}
-
-	// Get the state of the B pin
-	if (gpio_get_value(B_PIN) == VAL_HIGH)
+	else
 	{
-		s |= 0x08;
+		events_dropped += 1;
 	}
 
-	// It's a bit magic, we only increment on state E and D
-	//   and that gives exactly 1 update per detent on the encoder
-	if (s == 0x0E)
+	// A change of direction or a long pause starts the
+	//   velocity average over
+	uint32_t last = window[(window_index - 1) & WINDOW_MASK];
+
+	if ((delta != window_direction) || ((now - last) > WINDOW_TIMEOUT_US))
 	{
-		position += 1;
+		window_direction = delta;
+		window_count = 0;
 	}
-	else if (s == 0x0D)
+
+	window[window_index] = now;
+	window_index = (window_index + 1) & WINDOW_MASK;
+
+	if (window_count < WINDOW_SIZE)
 	{
-		position -= 1;
+		window_count += 1;
 	}
 
+	// The window must be written before the reader can see it
+	barrier();
+	window_sequence += 1;
+}
+
+static void update(uint8_t levels)
+{
+	// New A/B levels in bits 2-3, previous levels in bits 0-1
+	uint8_t s = levels | state;
+	int8_t delta = (int8_t)pgm_read_byte_near(table + s);
+
 	// Update global state
-	state = (s >> 2);
+	state = s >> 2;
+
+	// If both pins changed, an edge was missed and
+	//   there is no telling which way it went
+	if (delta == ERR)
+	{
+		errors += 1;
+
+		return;
+	}
+
+	// If the encoder moved a count,
+	if (delta != 0)
+	{
+		record(micros(), delta);
+		position += (uint16_t)delta;
+		event_post(EVENT_ENCODER);
+
+		// Let the user handle it right away
+		if (callback != NULL)
+		{
+			callback(delta);
+		}
+	}
 }
 
+#if DECODER_MODE == DECODER_SAMPLED
+static void sample(void)
+{
+	uint8_t raw = PIND & AB_MASK;
+	uint8_t levels = filtered;
+
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		uint8_t bit = (i == 0) ? A_BIT : B_BIT;
+		uint8_t count = integrator[i];
+
+		// Integrate toward the level the pin reads
+		if ((raw & bit) != 0)
+		{
+			if (count < FILTER_SAMPLES)
+			{
+				count += 1;
+			}
+		}
+		else if (count > 0)
+		{
+			count -= 1;
+		}
+
+		integrator[i] = count;
+
+		// Only a full swing changes the filtered level
+		if ((count == FILTER_SAMPLES) && ((levels & bit) == 0))
+		{
+			levels |= bit;
+			unsettled &= ~bit;
+		}
+		else if ((count == 0) && ((levels & bit) != 0))
+		{
+			levels &= ~bit;
+			unsettled &= ~bit;
+		}
+		// If the integrator is back where the filtered level is,
+		else if (count == (((levels & bit) != 0) ? FILTER_SAMPLES : 0))
+		{
+			// Whatever moved it was a glitch
+			if ((unsettled & bit) != 0)
+			{
+				unsettled &= ~bit;
+				noise += 1;
+			}
+		}
+		else
+		{
+			unsettled |= bit;
+		}
+	}
+
+	// If either filtered level changed,
+	if (levels != filtered)
+	{
+		filtered = levels;
+		// Update encoder state
+		update(levels);
+	}
+}
+#endif
+
 void encoder_init(void)
 {
 	#if PULLUP_ENABLE != 0
@@ -86,50 +295,209 @@ void encoder_init(void)
 	// Small delay to let any RC filters charge
 	delay_us(2000);
 
-	// Get initial value for A pin
-	if (gpio_get_value(A_PIN) == VAL_HIGH)
+	// Get initial value for A/B pins
+	uint8_t levels = PIND & AB_MASK;
+
+	state = levels >> 2;
+
+	#if DECODER_MODE == DECODER_SAMPLED
+		// Start the filter settled on the current levels
+		filtered = levels;
+		integrator[0] = ((levels & A_BIT) != 0) ? FILTER_SAMPLES : 0;
+		integrator[1] = ((levels & B_BIT) != 0) ? FILTER_SAMPLES : 0;
+		unsettled = 0;
+
+		// Set timer 2 to Clear Timer mode
+		//   CTC mode will clear the timer count at OCR2A
+		TCCR2A = (1 << WGM21);
+
+		// Set timer 2 compare for the sample rate
+		OCR2A = (F_CPU / 8 / SAMPLE_RATE_HZ) - 1;
+
+		// Set timer 2 clock prescale factor to 8
+		TCCR2B = (1 << CS21);
+
+		// Enable timer 2 compare interrupt
+		TIMSK2 |= (1 << OCIE2A);
+	#else
+		// Configure A/B interrupt sense to CHANGE
+		EICRA = (1 << ISC10) | (1 << ISC00);
+		// Enable A/B interrupts
+		EIMSK = (1 << INT1) | (1 << INT0);
+	#endif
+}
+
+int16_t encoder_read(void)
+{
+	// The count is free running, the change since the last
+	//   read is how far the encoder moved
+	uint16_t now = snapshot16(&position);
+	int16_t pos = (int16_t)(now - position_read);
+
+	position_read = now;
+
+	return pos;
+}
+
+uint16_t encoder_count(void)
+{
+	// Free running count, for readers that keep their own
+	//   last value and leave encoder_read() alone
+	return snapshot16(&position);
+}
+
+uint16_t encoder_errors(void)
+{
+	return snapshot16(&errors) - errors_base;
+}
+
+uint16_t encoder_noise(void)
+{
+	#if DECODER_MODE == DECODER_SAMPLED
+		return snapshot16(&noise) - noise_base;
+	#else
+		// The edge decoder can't tell noise from a real edge,
+		//   noise shows up in encoder_errors() instead
+		return 0;
+	#endif
+}
+
+void encoder_reset_stats(void)
+{
+	errors_base = snapshot16(&errors);
+	#if DECODER_MODE == DECODER_SAMPLED
+		noise_base = snapshot16(&noise);
+	#endif
+}
+
+uint8_t encoder_event_pop(encoder_event_t *event)
+{
+	uint8_t h = event_head;
+
+	// If there are no events,
+	if (h == event_tail)
+	{
+		// Nothing to do here
+		return 0;
+	}
+
+	// Only read the event after seeing it was queued
+	barrier();
+	*event = events[h & EVENT_MASK];
+	// The event must be copied before the ISR can reuse the slot
+	barrier();
+	event_head = h + 1;
+
+	return 1;
+}
+
+uint16_t encoder_events_dropped(void)
+{
+	return snapshot16(&events_dropped);
+}
+
+int32_t encoder_velocity(void)
+{
+	uint32_t now = micros();
+	uint8_t sequence;
+	uint8_t count;
+	int8_t direction;
+	uint32_t last;
+	uint32_t first;
+
+	// If a count comes in while copying the window, copy it again
+	do
+	{
+		sequence = window_sequence;
+		// Only read the window after the sequence
+		barrier();
+
+		count = window_count;
+		direction = window_direction;
+		last = window[(window_index - 1) & WINDOW_MASK];
+		first = window[(window_index - count) & WINDOW_MASK];
+
+		barrier();
+	} while (sequence != window_sequence);
+
+	// Need two counts for an interval
+	if (count < 2)
 	{
-		state |= 0x01;
+		return 0;
 	}
 
-	// Get initial value for B pin
-	if (gpio_get_value(B_PIN) == VAL_HIGH)
+	// Average time per count over the window
+	uint32_t intervals = count - 1;
+	uint32_t span = last - first;
+	uint32_t since = now - last;
+
+	// If it has been longer than that since the last count,
+	//   the encoder is slowing down or stopped
+	if (since > WINDOW_TIMEOUT_US)
 	{
-		state |= 0x02;
+		return 0;
 	}
 
-	// Configure A/B interrupt sense to CHANGE
-	EICRA = (1 << ISC10) | (1 << ISC00);
-	// Enable A/B interrupts
-	EIMSK = (1 << INT1) | (1 << INT0);
+	if ((since * intervals) > span)
+	{
+		span = since;
+		intervals = 1;
+	}
+
+	if (span == 0)
+	{
+		span = 1;
+	}
+
+	int32_t rate = (int32_t)((intervals * 1000000UL) / span);
+
+	return (direction < 0) ? -rate : rate;
 }
 
-int8_t encoder_read(void)
+void encoder_set_callback(encoder_callback_t cb)
 {
 	// Copy CPU flags
 	uint8_t sreg = SREG;
-	// Disable interrupts
+	// Disable interrupts, a pointer is 2 bytes
 	cli();
 
-	int8_t pos = position;
-	position = 0;
+	callback = cb;
 
 	// Restore CPU flags
 	SREG = sreg;
-
-	return pos;
 }
 
+#if DECODER_MODE == DECODER_SAMPLED
+// Timer 2 Compare Interrupt
+ISR(TIMER2_COMPA_vect)
+{
+	TRACE_BEGIN(TRACE_TIMER2);
+
+	// Sample and filter A/B
+	sample();
+
+	TRACE_END(TRACE_TIMER2);
+}
+#else
 // A Interrupt
 ISR(INT0_vect)
 {
+	TRACE_BEGIN(TRACE_INT0);
+
 	// Update encoder state
-	update();
+	update(PIND & AB_MASK);
+
+	TRACE_END(TRACE_INT0);
 }
 
 // B Interrupt
 ISR(INT1_vect)
 {
+	TRACE_BEGIN(TRACE_INT1);
+
 	// Update encoder state
-	update();
+	update(PIND & AB_MASK);
+
+	TRACE_END(TRACE_INT1);
 }
+#endif
@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "event.h"
+
+// Set to 0 to never sleep, event_wait() spins instead
+#define SLEEP_ENABLE 1
+
+static volatile uint8_t pending = 0;
+
+void event_init(void)
+{
+	pending = 0;
+
+	// Idle keeps the timers, SPI and UART running, any
+	//   interrupt wakes the CPU back up
+	set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+void event_post(uint8_t events)
+{
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts, ISRs and the main loop both post
+	cli();
+
+	pending |= events;
+
+	// Restore CPU flags
+	SREG = sreg;
+}
+
+uint8_t event_wait(void)
+{
+	// Disable interrupts, an event posted between the
+	//   check and the sleep would not wake us up
+	cli();
+
+	while (pending == 0)
+	{
+		#if SLEEP_ENABLE != 0
+			// sei() only takes effect after the next instruction,
+			//   so nothing can post between the check and the
+			//   sleep, and any event after that wakes us up
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		#else
+			sei();
+		#endif
+
+		cli();
+	}
+
+	// Take every pending event at once
+	uint8_t events = pending;
+	pending = 0;
+
+	// Enable interrupts
+	sei();
+
+	return events;
+}
@@ -0,0 +1,81 @@
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+
+#include "format.h"
+
+// Powers of 10 for converting to decimal without dividing
+static const uint32_t powers[] PROGMEM =
+{
+	1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1
+};
+
+void format_position(int32_t value, char *digits)
+{
+	// Decimal digits of the value, most significant first
+	uint8_t decimal[10];
+	// Index of the first digit to show
+	uint8_t first = 10;
+	// Assume value is positive, first digit is empty
+	char prefix = ' ';
+	// Unsigned so -2147483648 doesn't overflow
+	uint32_t magnitude = (uint32_t)value;
+
+	// If value is negative,
+	if (value < 0)
+	{
+		// Set first digit to negative sign
+		prefix = '-';
+		// Ensure magnitude is positive
+		magnitude = 0 - magnitude;
+	}
+
+	// Split into decimal digits by repeated subtraction,
+	//   at most 9 subtractions per digit and no division
+	for (uint8_t i = 0; i < 10; i++)
+	{
+		uint32_t power = pgm_read_dword_near(powers + i);
+		uint8_t digit = 0;
+
+		while (magnitude >= power)
+		{
+			magnitude -= power;
+			digit++;
+		}
+
+		decimal[i] = digit;
+
+		// Remember the most significant non-zero digit
+		if ((digit != 0) && (first == 10))
+		{
+			first = i;
+		}
+	}
+
+	// Always show at least 5 digits, so values < 1"
+	//   have one zero to the left of the decimal point
+	if (first > 5)
+	{
+		first = 5;
+	}
+
+	// Right align with leading spaces
+	//   Values with more than 7 digits keep the 7 most
+	//   significant, the same as snprintf() truncating
+	uint8_t count = 10 - first;
+	uint8_t pad = (count < 7) ? (7 - count) : 0;
+
+	digits[0] = prefix;
+
+	for (uint8_t i = 0; i < 7; i++)
+	{
+		if (i < pad)
+		{
+			digits[i + 1] = ' ';
+		}
+		else
+		{
+			digits[i + 1] = '0' + decimal[first + i - pad];
+		}
+	}
+}
@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "gear.h"
+
+// Step pulses per position count is numerator / denominator
+//   The fraction left over from every conversion is carried in
+//   remainder, so that after any sequence of moves
+//   steps * denominator + remainder == counts * numerator
+//   and the step output never drifts from the position
+static uint16_t numerator = 1;
+static uint16_t denominator = 1;
+static uint16_t remainder = 0;
+// Remainder after the last gear_convert(), kept by gear_commit()
+static uint16_t remainder_next = 0;
+// Most counts that convert to a signed 16 bit step count
+static uint16_t max_input = INT16_MAX;
+
+static uint16_t get_max_input(const gear_ratio_t *ratio)
+{
+	uint16_t num = ratio->numerator;
+	uint16_t den = ratio->denominator;
+
+	// A zero in either place can't make steps
+	if ((num == 0) || (den == 0))
+	{
+		return 0;
+	}
+
+	// Largest input where counts * num / den stays under INT16_MAX,
+	//   with room for the remainder to add one more step
+	uint32_t max = ((uint32_t)(INT16_MAX - 1) * den) / num;
+
+	if (max > INT16_MAX)
+	{
+		max = INT16_MAX;
+	}
+
+	return (uint16_t)max;
+}
+
+void gear_init(const gear_ratio_t *ratio)
+{
+	gear_set_ratio(ratio);
+}
+
+uint8_t gear_is_valid(const gear_ratio_t *ratio)
+{
+	// At least one count has to fit in a step segment
+	return get_max_input(ratio) != 0;
+}
+
+void gear_set_ratio(const gear_ratio_t *ratio)
+{
+	uint16_t max = get_max_input(ratio);
+
+	// Ratios that can't make steps are rejected by settings.c,
+	//   keep the old one rather than stall the output
+	if (max == 0)
+	{
+		return;
+	}
+
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts, the encoder interrupt may be converting
+	cli();
+
+	numerator = ratio->numerator;
+	denominator = ratio->denominator;
+	max_input = max;
+	// The old fraction means nothing at the new ratio
+	remainder = 0;
+	remainder_next = 0;
+
+	// Restore CPU flags
+	SREG = sreg;
+}
+
+void gear_get_ratio(gear_ratio_t *ratio)
+{
+	ratio->numerator = numerator;
+	ratio->denominator = denominator;
+}
+
+uint16_t gear_max_input(void)
+{
+	return max_input;
+}
+
+int16_t gear_convert(int16_t counts)
+{
+	// Whole steps are always a plain multiply
+	if (denominator == 1)
+	{
+		remainder_next = 0;
+
+		return counts * (int16_t)numerator;
+	}
+
+	if (counts >= 0)
+	{
+		// Add the new counts to the fraction carried over
+		uint32_t total = ((uint32_t)counts * numerator) + remainder;
+
+		remainder_next = (uint16_t)(total % denominator);
+
+		return (int16_t)(total / denominator);
+	}
+
+	// Going the other way, take the counts out of the fraction
+	//   and round the steps away from zero so the remainder
+	//   stays positive
+	uint32_t needed = (uint32_t)(0 - counts) * numerator;
+
+	if (needed <= remainder)
+	{
+		remainder_next = remainder - (uint16_t)needed;
+
+		return 0;
+	}
+
+	uint32_t steps = ((needed - remainder) + (denominator - 1)) / denominator;
+
+	remainder_next = (uint16_t)((steps * denominator) + remainder - needed);
+
+	return -(int16_t)steps;
+}
+
+void gear_commit(void)
+{
+	// Keep the fraction from the last conversion, only once
+	//   its steps were actually queued
+	remainder = remainder_next;
+}
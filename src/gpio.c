@@ -65,7 +65,7 @@ static volatile uint8_t *get_dir(gpio_t gpio)
 	}
 }
 
-static volatile uint8_t *get_port_read(gpio_t gpio)
+static const volatile uint8_t *get_port_read(gpio_t gpio)
 {
 	switch (gpio)
 	{
@@ -345,7 +345,7 @@ void gpio_direction(gpio_t gpio, gpio_direction_t direction)
 	SREG = sreg;
 }
 
-void gpio_set_value(gpio_t gpio, gpio_value_t value)
+void gpio_set_value_runtime(gpio_t gpio, gpio_value_t value)
 {
 	volatile uint8_t *out = get_port_write(gpio);
 	uint8_t bit = get_pin_bit(gpio);
@@ -355,7 +355,9 @@ void gpio_set_value(gpio_t gpio, gpio_value_t value)
 		return;
 	}
 
+	// Copy CPU flags
 	uint8_t sreg = SREG;
+	// Disable interrupts
 	cli();
 
 	switch (value)
@@ -379,9 +381,9 @@ void gpio_set_value(gpio_t gpio, gpio_value_t value)
 	SREG = sreg;
 }
 
-gpio_value_t gpio_get_value(gpio_t gpio)
+gpio_value_t gpio_get_value_runtime(gpio_t gpio)
 {
-	volatile uint8_t *in = get_port_read(gpio);
+	const volatile uint8_t *in = get_port_read(gpio);
 	uint8_t bit = get_pin_bit(gpio);
 
 	if ((in == NULL) || (bit == 0))
@@ -389,14 +391,9 @@ gpio_value_t gpio_get_value(gpio_t gpio)
 		return VAL_LOW;
 	}
 
-	uint8_t sreg = SREG;
-	cli();
-
+	// A single read, nothing to protect
 	uint8_t value = *in & bit;
 
-	// Restore CPU flags
-	SREG = sreg;
-
 	if (value == bit)
 	{
 		return VAL_HIGH;
@@ -405,7 +402,7 @@ gpio_value_t gpio_get_value(gpio_t gpio)
 	return VAL_LOW;
 }
 
-void gpio_toggle(gpio_t gpio)
+void gpio_toggle_runtime(gpio_t gpio)
 {
 	volatile uint8_t *out = get_port_write(gpio);
 	uint8_t bit = get_pin_bit(gpio);
@@ -415,7 +412,9 @@ void gpio_toggle(gpio_t gpio)
 		return;
 	}
 
+	// Copy CPU flags
 	uint8_t sreg = SREG;
+	// Disable interrupts
 	cli();
 
 	// Toggle output
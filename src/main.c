@@ -9,16 +9,55 @@
 #include "gpio.h"
 #include "uart.h"
 #include "display.h"
-
-// Ration of input pulses from the encoder to pulses
-//   of the step output
-#define OUTPUT_GAIN 4
-
+#include "spi.h"
+#include "stepper.h"
+#include "profile.h"
+#include "button.h"
+#include "event.h"
+#include "gear.h"
+#include "trace.h"
+#include "task.h"
+#include "telemetry.h"
+#include "snapshot.h"
+#include "settings.h"
+#include "command.h"
+
+// Serial baud rate for printf() output
+//   Up to 1M works, 250k, 500k and 1M are exact at 16MHz
+//   The telemetry stream doesn't fit in 9600, it needs 500k at
+//   its fastest rate, see telemetry.h
+#if TELEMETRY_ENABLE != 0
+	#define UART_BAUD 500000
+#else
+	#define UART_BAUD 9600
+#endif
+
+// Step output pulses per 0.0001" of position, as a fraction
+//   so leadscrews without a whole number of steps per count
+//   still track the display exactly, e.g. 127/25 => 5.08
+//   Can be changed at runtime over the UART, see command.c
+#define GEAR_NUMERATOR 4
+#define GEAR_DENOMINATOR 1
+
+// Periodic tasks run from the task table in main(), each one
+//   on a fixed schedule from when it was first due
 // How fast the encoder value is polled
 #define READ_UPDATE_MS 10
-// How fast the buttons are polled, display is updated, and
-//   the step output pulses are generated
+// How fast the LED is flashed and, in batched mode, the
+//   step output pulses are generated
 #define WRITE_UPDATE_MS 100
+// How often every display register is rewritten, updates
+//   in between only send the digits that changed
+#define DISPLAY_REFRESH_MS 1000
+
+// Output modes
+//   Streaming => Each encoder detent wakes the main loop, which
+//     queues it for the step generator right away
+//   Batched => Position changes are collected and queued
+//     every WRITE_UPDATE_MS
+#define OUTPUT_STREAMING 0
+#define OUTPUT_BATCHED 1
+#define OUTPUT_MODE OUTPUT_STREAMING
 
 // Full pulse length is 2 * PULSE_TIME_US
 // 200kHz = 5us total pulse length
@@ -27,10 +66,26 @@
 //   PULSE_TIME_US = 3, or 166.67kHz
 #define PULSE_TIME_US 5
 // Set to 0 to disable dwell timer
-#define DWELL_ENABLE 1
+//   The acceleration profile below spaces out the pulses,
+//   the dwell is only needed for drivers that want a gap
+#define DWELL_ENABLE 0
 // Number of microseconds to wait between each set of
-//   OUTPUT_GAIN step output pulses
+//   step output pulses for one count, rounded to whole pulses
 #define DWELL_TIME_US 100
+// Time to let the driver latch in the direction output
+//   before step pulses start arriving
+#define DIR_SETUP_US 2
+
+// Step rate acceleration profile for each move
+//   The rate ramps from PROFILE_START_RATE up to at most
+//   PROFILE_MAX_RATE and back down before the last step
+//   The pulse time above still caps the top rate
+// Step rate at the start and end of a move, in steps/s
+#define PROFILE_START_RATE 10000
+// Step rate at the top of the ramp, in steps/s
+#define PROFILE_MAX_RATE 100000
+// Acceleration, in steps/s^2
+#define PROFILE_ACCEL 10000000
 
 // Encoder direction
 //   Right positive => Turn clockwise to go up
@@ -47,250 +102,599 @@
 #define DIRECTION_OUTPUT DIR_HIGH
 
 // Set to 0 to disable flashing the onboard LED
-#define LED_ENABLE 1
+//   The onboard LED is on D13, which is SCK for hardware SPI
+#if SPI_BACKEND == SPI_HARDWARE
+	#define LED_ENABLE 0
+#else
+	#define LED_ENABLE 1
+#endif
 #define LED_PIN D13
 
 // Increment settings in 0.0001"
 #define INCREMENT_FINE 1
 #define INCREMENT_COARSE 10
 
-#define ZERO_PIN D4
-#define COARSE_PIN D5
-#define FINE_PIN D6
+// Set to 0 to disable adaptive gain
+//   The increment follows how fast the encoder is turned, slow
+//   turns move INCREMENT_FINE per count and fast spins up to
+//   ADAPTIVE_MAX_INCREMENT per count
+//   It starts off, holding the fine button turns it on and
+//   pressing either button picks that fixed increment again
+#define ADAPTIVE_ENABLE 1
+// Turn rate where the increment starts to grow, in counts/s
+#define ADAPTIVE_SLOW_RATE 10
+// Turn rate where the increment reaches the maximum, in counts/s
+#define ADAPTIVE_FAST_RATE 200
+// Largest adaptive increment in 0.0001", at most 127
+#define ADAPTIVE_MAX_INCREMENT 50
+
+// Shape of the adaptive curve between the slow and fast rates
+//   Linear => Increment grows evenly with the rate
+//   Quadratic => Stays fine longer, then ramps up quickly
+#define CURVE_LINEAR 0
+#define CURVE_QUADRATIC 1
+#define ADAPTIVE_CURVE CURVE_QUADRATIC
+
+// Increment modes
+#define GAIN_ADAPTIVE 0
+#define GAIN_FINE 1
+#define GAIN_COARSE 2
+
+// Readout modes, holding the zero button switches between them
+//   Absolute => Position from where the zero button was last pressed
+//   Relative => Position from a work offset, the zero button
+//     moves the work offset and leaves the absolute zero alone
+#define READOUT_ABSOLUTE 0
+#define READOUT_RELATIVE 1
+
+// Position is updated from the encoder interrupt in streaming mode
+static volatile int32_t position = 0;
+static int32_t position_last = 0;
+static int32_t position_displayed = 0;
+static volatile uint8_t increment = INCREMENT_FINE;
+static uint8_t gain_mode = GAIN_FINE;
+static int32_t work_offset = 0;
+static uint8_t readout = READOUT_ABSOLUTE;
+// Set when a long press was handled, so the release
+//   doesn't also count as a short press
+static uint8_t zero_long = 0;
+
+// Settings built into the firmware, replaced at startup by
+//   any saved over the UART, and changed live with the
+//   commands in command.c
+static settings_t settings =
+{
+	.timing =
+	{
+		.pulse_us = PULSE_TIME_US,
+		.setup_us = DIR_SETUP_US,
+		#if DWELL_ENABLE != 0
+			.dwell_us = DWELL_TIME_US,
+		#else
+			.dwell_us = 0,
+		#endif
+		.group = (GEAR_NUMERATOR + (GEAR_DENOMINATOR / 2)) / GEAR_DENOMINATOR,
+	},
+	.gear =
+	{
+		.numerator = GEAR_NUMERATOR,
+		.denominator = GEAR_DENOMINATOR,
+	},
+	// Step rate profile, only changes while the stepper is idle
+	.profile =
+	{
+		.start_rate = PROFILE_START_RATE,
+		.max_rate = PROFILE_MAX_RATE,
+		.accel = PROFILE_ACCEL,
+	},
+	.increment_fine = INCREMENT_FINE,
+	.increment_coarse = INCREMENT_COARSE,
+	.encoder_reverse = (ENCODER_DIRECTION == LEFT_POSITIVE),
+	.direction_low = (DIRECTION_OUTPUT == DIR_LOW),
+};
+
+static int32_t get_position(void)
+{
+	// Position is 4 bytes, read it until the encoder
+	//   interrupt didn't update it mid-copy
+	return (int32_t)snapshot32((const volatile uint32_t *)&position);
+}
+
+#if ADAPTIVE_ENABLE != 0
+static uint8_t get_adaptive_increment(void)
+{
+	int32_t velocity = encoder_velocity();
+	uint32_t rate = (velocity < 0) ? -velocity : velocity;
 
-#define STEP_OUT_PIN A0
-#define DIR_OUT_PIN A1
+	uint8_t fine = settings.increment_fine;
 
-static int32_t position = 0;
-static int32_t position_last = 0;
-static uint8_t increment = INCREMENT_FINE;
-static uint32_t read_time = 0;
-static uint32_t write_time = 0;
-static uint8_t button_state = 0;
+	// Slower than the bottom of the curve, or the fine
+	//   increment is already past the top of it
+	if ((rate <= ADAPTIVE_SLOW_RATE) || (fine >= ADAPTIVE_MAX_INCREMENT))
+	{
+		return fine;
+	}
+
+	// Faster than the top of the curve
+	if (rate >= ADAPTIVE_FAST_RATE)
+	{
+		return ADAPTIVE_MAX_INCREMENT;
+	}
 
-static void handle_buttons(void)
+	// Position along the curve
+	uint32_t x = rate - ADAPTIVE_SLOW_RATE;
+	uint32_t span = ADAPTIVE_FAST_RATE - ADAPTIVE_SLOW_RATE;
+
+	#if ADAPTIVE_CURVE == CURVE_QUADRATIC
+		x *= x;
+		span *= span;
+	#endif
+
+	return fine + (((ADAPTIVE_MAX_INCREMENT - fine) * x) / span);
+}
+#endif
+
+static void select_gain(uint8_t mode)
 {
-	#define ZERO_BIT (1 << 0)
-	#define COARSE_BIT (1 << 1)
-	#define FINE_BIT (1 << 2)
+	gain_mode = mode;
 
-	uint8_t state = 0;
+	if (mode == GAIN_COARSE)
+	{
+		increment = settings.increment_coarse;
+	}
+	else
+	{
+		increment = settings.increment_fine;
+	}
+}
 
-	// If the button is pressed
-	if (gpio_get_value(ZERO_PIN) == VAL_LOW)
+static void handle_zero(void)
+{
+	// In relative mode only the work offset moves
+	if (readout == READOUT_RELATIVE)
 	{
-		// Copy the state
-		state |= ZERO_BIT;
+		work_offset = get_position();
+		printf("Work Offset Zeroed\n");
 
-		// ...and we didn't already process the button input
-		if ((button_state & ZERO_BIT) == 0)
-		{
-			// Do the thing, only once per press
-			position = 0;
-			printf("Zero Button Pressed\n");
-		}
+		return;
 	}
 
-	// Repeat for all user inputs
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts, the encoder may be moving
+	cli();
+
+	// Zero the reference too, so the table doesn't
+	//   get driven back to the old zero
+	position = 0;
+	position_last = 0;
+
+	// Restore CPU flags
+	SREG = sreg;
+	printf("Zero Button Pressed\n");
+}
+
+static void handle_zero_long(void)
+{
+	if (readout == READOUT_ABSOLUTE)
+	{
+		// Start measuring from here
+		readout = READOUT_RELATIVE;
+		work_offset = get_position();
+		printf("Work Offset Set\n");
+	}
+	else
+	{
+		readout = READOUT_ABSOLUTE;
+		work_offset = 0;
+		printf("Absolute Readout\n");
+	}
+}
 
-	if (gpio_get_value(COARSE_PIN) == VAL_LOW)
+static void handle_button(const button_event_t *event)
+{
+	switch (event->button)
 	{
-		state |= COARSE_BIT;
+		case BUTTON_ZERO:
+		{
+			if (event->action == BUTTON_LONG_PRESS)
+			{
+				zero_long = 1;
+				handle_zero_long();
+			}
+			// A short press acts on release, once it is
+			//   clear the button isn't being held
+			else if (event->action == BUTTON_RELEASE)
+			{
+				if (zero_long == 0)
+				{
+					handle_zero();
+				}
+
+				zero_long = 0;
+			}
+
+			break;
+		}
 
-		if ((button_state & COARSE_BIT) == 0)
+		case BUTTON_COARSE:
 		{
-			increment = INCREMENT_COARSE;
-			printf("Coarse Button Pressed\n");
+			if (event->action == BUTTON_PRESS)
+			{
+				printf("Coarse Button Pressed\n");
+				select_gain(GAIN_COARSE);
+			}
+
+			break;
 		}
-	}
 
-	if (gpio_get_value(FINE_PIN) == VAL_LOW)
-	{
-		state |= FINE_BIT;
+		case BUTTON_FINE:
+		{
+			if (event->action == BUTTON_PRESS)
+			{
+				printf("Fine Button Pressed\n");
+				select_gain(GAIN_FINE);
+			}
+			#if ADAPTIVE_ENABLE != 0
+				// Holding it lets the increment follow the turn rate
+				else if (event->action == BUTTON_LONG_PRESS)
+				{
+					gain_mode = GAIN_ADAPTIVE;
+					printf("Adaptive Gain\n");
+				}
+			#endif
+
+			break;
+		}
 
-		if ((button_state & FINE_BIT) == 0)
+		default:
 		{
-			increment = INCREMENT_FINE;
-			printf("Fine Button Pressed\n");
+			break;
 		}
 	}
+}
 
-	// Update the button state
-	button_state = state;
+static void handle_encoder(int16_t value)
+{
+	// Local copy of increment
+	int16_t inc = increment;
+
+	// Negate increment depending on desired rotation direction
+	if (settings.encoder_reverse != 0)
+	{
+		inc = -inc;
+	}
 
-	#undef ZERO_BIT
-	#undef COARSE_BIT
-	#undef FINE_BIT
+	// Increment position, a batched read may hold several counts
+	position += (int32_t)value * inc;
 }
 
 static void handle_output(void)
 {
+	int32_t pos = get_position();
+
 	// If the position hasn't changed since we last checked,
-	if (position == position_last)
+	if (pos == position_last)
 	{
 		// Nothing to do here
 		return;
 	}
 
+	TRACE_BEGIN(TRACE_OUTPUT_STEPS);
+
 	// Compute the change in position
-	int8_t diff = position - position_last;
-	// Update last position
-	position_last = position;
+	int32_t diff = pos - position_last;
+	// Largest change that fits in one step segment
+	int16_t max = gear_max_input();
+
+	// Large moves are sent over multiple updates
+	if (diff > max)
+	{
+		diff = max;
+	}
+	else if (diff < -max)
+	{
+		diff = -max;
+	}
 
-	gpio_value_t direction;
+	// Convert to step pulses, carrying any fraction of a step
+	//   over to the next move
+	int16_t steps = gear_convert((int16_t)diff);
+	uint16_t count = steps;
 
-	// Assume difference is positive
-	#if DIRECTION_OUTPUT == DIR_HIGH
-		direction = VAL_HIGH;
-	#else
-		direction = VAL_LOW;
-	#endif
+	// Assume steps are positive
+	gpio_value_t direction = (settings.direction_low != 0) ? VAL_LOW : VAL_HIGH;
 
-	// If the difference is negative, flip the direction level
-	if (diff < 0)
+	// If the steps are negative, flip the direction level
+	if (steps < 0)
 	{
-		#if DIRECTION_OUTPUT == DIR_HIGH
-			direction = VAL_LOW;
-		#else
-			direction = VAL_HIGH;
-		#endif
+		direction = (direction == VAL_HIGH) ? VAL_LOW : VAL_HIGH;
+
+		// Ensure count is always positive
+		count = -steps;
+	}
+
+	// Queue step pulses, the step generator sends them out
+	//   in the background with the configured timing
+	//   A move shorter than one step only adds to the fraction
+	if ((count != 0) && (stepper_move(count, direction, 0) == 0))
+	{
+		// Step queue is full, try again on the next update
+		TRACE_END(TRACE_OUTPUT_STEPS);
 
-		// Ensure diff is always positive
-		diff = -diff;
+		return;
 	}
 
-	// Set the direction output
-	gpio_set_value(DIR_OUT_PIN, direction);
-	// Small delay to give the driver time to latch in the direction
-	//   before step pulses start arriving
-	delay_us(2);
+	// Keep the fraction and update last position with
+	//   what was actually queued
+	gear_commit();
+	position_last += diff;
+
+	TRACE_END(TRACE_OUTPUT_STEPS);
+}
+
+static void apply_settings(void)
+{
+	// If nothing was changed over the UART,
+	if (settings_pending() == 0)
+	{
+		// Nothing to do here
+		return;
+	}
 
-	// Send out step pulses
-	for (uint8_t i = 0; i < (uint8_t)diff; i++)
+	// Settings only change between moves, once the stepper
+	//   is idle and every count has been sent, so no move runs
+	//   with half old and half new settings
+	if ((stepper_busy() == 0) && (get_position() == position_last))
 	{
-		// In fine mode, the maximum diff is ~9
-		//   Or, at most 36 pulses, or ~360us
+		// Settings that don't work together aren't applied, the
+		//   old ones stay in use until another set fixes them
+		if (settings_take(&settings) == 0)
+		{
+			printf("Bad Settings, not applied\n");
+		}
+		else
+		{
+			stepper_set_timing(&settings.timing);
+			gear_set_ratio(&settings.gear);
+			profile_init(&settings.profile);
+
+			// Pick up new increments if a button chose one
+			if (gain_mode == GAIN_COARSE)
+			{
+				increment = settings.increment_coarse;
+			}
+			else if (gain_mode == GAIN_FINE)
+			{
+				increment = settings.increment_fine;
+			}
+
+			printf("Settings Applied\n");
+		}
+	}
+}
+
+static void handle_commands(void)
+{
+	// Line commands over the UART, see command.c
+	command_poll();
+
+	apply_settings();
+}
 
-		// In coarse mode, the maximum diff is ~90 (usually 80)
-		//   Or, at most 360 pulses, or ~3.6ms
+static void handle_read(void)
+{
+	#if ADAPTIVE_ENABLE != 0
+		// Follow the turn rate unless a button overrides it
+		if (gain_mode == GAIN_ADAPTIVE)
+		{
+			increment = get_adaptive_increment();
+		}
+	#endif
+
+	#if OUTPUT_MODE == OUTPUT_BATCHED
+		// Read encoder value
+		int16_t value = encoder_read();
 
-		// Bit bang step ouptut pulses with 50% duty cycle
-		for (uint8_t j = 0; j < OUTPUT_GAIN; j++)
+		// If the encoder value has changed since we last looked,
+		if (value != 0)
 		{
-			// Set step pin high
-			PORTC |= 0x01;
-			// Delay
-			delay_us(PULSE_TIME_US);
-			// Set step pin low
-			PORTC &= 0xFE;
-			// Delay
-			delay_us(PULSE_TIME_US);
+			handle_encoder(value);
 		}
+	#endif
 
-		// Configurable dwell time to separate each group of 4 step pulses
-		#if DWELL_ENABLE != 0
-			delay_us(DWELL_TIME_US);
-		#endif
+	int32_t pos = get_position() - work_offset;
+
+	// If the position has changed since we last looked,
+	if (pos != position_displayed)
+	{
+		position_displayed = pos;
+		// Update LED display
+		display_update(pos);
 	}
 }
 
-static void gpio_init(void)
+static void handle_write(void)
 {
+	// Toggle LED if desired
 	#if LED_ENABLE != 0
-		gpio_direction(LED_PIN, DIR_OUTPUT);
+		gpio_toggle(LED_PIN);
 	#endif
 
-	gpio_direction(ZERO_PIN, DIR_INPUT);
-	gpio_direction(COARSE_PIN, DIR_INPUT);
-	gpio_direction(FINE_PIN, DIR_INPUT);
+	#if OUTPUT_MODE == OUTPUT_BATCHED
+		// Transmit step pulses to output
+		handle_output();
+	#endif
+}
+
+static void handle_refresh(void)
+{
+	// Guard against display glitches
+	display_refresh();
+}
+
+#if TELEMETRY_ENABLE != 0
+static void handle_telemetry(void)
+{
+	telemetry_send(get_position());
+}
+#endif
+
+#if OUTPUT_MODE == OUTPUT_STREAMING
+static void handle_detent(int8_t value)
+{
+	// Called from the encoder interrupt for every detent, which
+	//   also wakes the main loop to queue the steps
+	handle_encoder(value);
+}
+#endif
+
+// Periodic tasks, phases spread them out so they don't
+//   all come due on the same tick
+static const task_config_t tasks[] =
+{
+	{
+		.name = "read",
+		.period_ms = READ_UPDATE_MS,
+		.phase_ms = 0,
+		.priority = 0,
+		.handler = handle_read,
+	},
+	{
+		.name = "write",
+		.period_ms = WRITE_UPDATE_MS,
+		.phase_ms = 5,
+		.priority = 1,
+		.handler = handle_write,
+	},
+	{
+		.name = "commands",
+		.period_ms = 1,
+		.phase_ms = 0,
+		.priority = 2,
+		.handler = handle_commands,
+	},
+	{
+		.name = "refresh",
+		.period_ms = DISPLAY_REFRESH_MS,
+		.phase_ms = 7,
+		.priority = 3,
+		.handler = handle_refresh,
+	},
+	#if TELEMETRY_ENABLE != 0
+		{
+			.name = "telemetry",
+			.period_ms = 1000 / TELEMETRY_RATE_HZ,
+			.phase_ms = 2,
+			.priority = 2,
+			.handler = handle_telemetry,
+		},
+	#endif
+};
 
-	gpio_set_value(STEP_OUT_PIN, VAL_LOW);
-	gpio_direction(STEP_OUT_PIN, DIR_OUTPUT);
-	gpio_set_value(DIR_OUT_PIN, VAL_LOW);
-	gpio_direction(DIR_OUT_PIN, DIR_OUTPUT);
+static void gpio_init(void)
+{
+	#if LED_ENABLE != 0
+		gpio_direction(LED_PIN, DIR_OUTPUT);
+	#endif
 }
 
 int main(void)
 {
-	// Setup Timer 0 for millis()/micros()
+	// Setup sleep between events
+	event_init();
+	#if TRACE_ENABLE != 0
+		// Setup trace stats or debug pins
+		trace_init();
+	#endif
+	// Setup Timer 0 for millis() and Timer 1 for micros()
 	clock_init();
 	// Setup UART and attach printf()
-	uart_init(9600);
+	uart_init(UART_BAUD);
 	// Setup encoder inputs and interrupts
 	encoder_init();
-	// Detup LED display and software SPI
+	// Setup LED display and SPI
 	display_init();
 	// Configure I/Os
 	gpio_init();
+	// Setup button inputs and debounce
+	button_init();
+	// Use any settings saved over the UART
+	if (settings_init(&settings) != 0)
+	{
+		printf("Saved Settings Loaded\n");
+	}
+	// Build the acceleration ramp
+	profile_init(&settings.profile);
+	// Setup the step output gearing
+	gear_init(&settings.gear);
+	// Setup step/direction outputs and Timer 1 compares
+	stepper_init(&settings.timing);
+
+	#if OUTPUT_MODE == OUTPUT_STREAMING
+		// Move the position from the encoder interrupt
+		encoder_set_callback(handle_detent);
+	#endif
 
 	// Reset globals
 	position = 0;
 	position_last = 0;
-	increment = INCREMENT_FINE;
-	read_time = millis();
-	write_time = read_time;
-	button_state = 0;
+	position_displayed = 0;
+	increment = settings.increment_fine;
+	// Always start on the fine increment, adaptive gain has
+	//   to be asked for
+	gain_mode = GAIN_FINE;
+	work_offset = 0;
+	readout = READOUT_ABSOLUTE;
+	zero_long = 0;
 
 	// Display 0.0000
 	display_update(position);
 
+	#if TELEMETRY_ENABLE != 0
+		// Start the deltas in the first sample from here
+		telemetry_init();
+	#endif
+
+	// Start the periodic tasks
+	task_init(tasks, sizeof(tasks) / sizeof(tasks[0]));
+
 	// Enable interrupts
 	sei();
 
 	while (1)
 	{
-		// Get the current time
-		uint32_t now = millis();
+		// Sleep until an interrupt posts something to do
+		uint8_t events = event_wait();
 
-		// Check for a read update
-		if ((now - read_time) > READ_UPDATE_MS)
+		// If the step queue has room again or a detent came in,
+		if ((events & (EVENT_STEPPER | EVENT_ENCODER)) != 0)
 		{
-			// Update last time
-			read_time = now;
+			// Keep the step generator fed
+			stepper_update();
+
+			#if OUTPUT_MODE == OUTPUT_STREAMING
+				// Queue new detents, and anything the step queue
+				//   had no room for before
+				handle_output();
+			#endif
+		}
 
-			// Read encoder value
-			int8_t value = encoder_read();
-			// Local copy of increment
-			int8_t inc = increment;
+		if ((events & EVENT_BUTTON) != 0)
+		{
+			button_event_t event;
 
-			// If the encoder value has changed since we last looked,
-			if (value != 0)
+			// Handle user inputs as soon as they are debounced
+			while (button_event_pop(&event) != 0)
 			{
-				// Negate increment depending on desired rotation direction
-				#if ENCODER_DIRECTION == RIGHT_POSITIVE
-					if (value < 0)
-					{
-						inc = -inc;
-					}
-				#else
-					if (value > 0)
-					{
-						inc = -inc;
-					}
-				#endif
-
-				// Increment position
-				position += inc;
-				// Update LED display
-				display_update(position);
+				handle_button(&event);
 			}
 		}
 
-		// Check for a write update
-		if ((now - write_time) > WRITE_UPDATE_MS)
+		// The tasks only need checking when the clock has moved on
+		if ((events & EVENT_TICK) != 0)
 		{
-			// Update last time
-			write_time = now;
-
-			// Toggle LED if desired
-			#if LED_ENABLE != 0
-				gpio_toggle(LED_PIN);
-			#endif
-
-			// Handle user inputs
-			handle_buttons();
-			// Transmit step pulses to output
-			handle_output();
+			task_run();
 		}
 	}
 
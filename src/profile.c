@@ -0,0 +1,159 @@
+#include <stdint.h>
+
+#include "profile.h"
+
+// Number of intervals in the ramp table, each one covers
+//   a power of 2 number of steps along the ramp
+#define TABLE_SIZE 64
+
+// Step period in timer counts at the start of each interval,
+//   plus one more for the end of the last interval
+static uint16_t table[TABLE_SIZE + 1] = {0};
+// Number of steps from start_rate to max_rate
+static uint16_t ramp_length = 0;
+// Steps per table entry as a power of 2
+static uint8_t ramp_shift = 0;
+// Current position along the ramp in steps
+static uint16_t ramp_position = 0;
+
+static uint32_t isqrt(uint64_t value)
+{
+	uint64_t result = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+
+	// Start at the highest power of 4 <= value
+	while (bit > value)
+	{
+		bit >>= 2;
+	}
+
+	// Digit-by-digit square root, one result bit per pass
+	while (bit != 0)
+	{
+		if (value >= (result + bit))
+		{
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else
+		{
+			result >>= 1;
+		}
+
+		bit >>= 2;
+	}
+
+	return (uint32_t)result;
+}
+
+static uint16_t get_period(uint32_t rate)
+{
+	// Slowest rate that still fits in 16 bits of timer counts
+	if (rate <= (PROFILE_TICK_HZ / UINT16_MAX))
+	{
+		return UINT16_MAX;
+	}
+
+	return (uint16_t)(PROFILE_TICK_HZ / rate);
+}
+
+void profile_init(const profile_config_t *config)
+{
+	uint32_t start = config->start_rate;
+	uint32_t max = config->max_rate;
+	uint64_t length = 0;
+
+	// Never start faster than the top of the ramp
+	if (start > max)
+	{
+		start = max;
+	}
+
+	// With constant acceleration the rate squared grows linearly
+	//   with distance: v^2 = start^2 + 2 * accel * steps
+	uint64_t start_squared = (uint64_t)start * start;
+
+	if (config->accel != 0)
+	{
+		length = ((uint64_t)max * max - start_squared) / (2 * (uint64_t)config->accel);
+	}
+
+	// The ramp position is tracked in 16 bits
+	if (length > UINT16_MAX)
+	{
+		length = UINT16_MAX;
+	}
+
+	// Find the smallest number of steps per entry that
+	//   fits the whole ramp in the table
+	uint8_t shift = 0;
+
+	while ((length >> shift) >= TABLE_SIZE)
+	{
+		shift++;
+	}
+
+	// Fill in the step period at the start of each interval
+	for (uint8_t i = 0; i <= TABLE_SIZE; i++)
+	{
+		uint64_t steps = (uint64_t)i << shift;
+
+		if (steps > length)
+		{
+			steps = length;
+		}
+
+		uint32_t rate = isqrt(start_squared + (2 * (uint64_t)config->accel * steps));
+
+		table[i] = get_period(rate);
+	}
+
+	ramp_length = (uint16_t)length;
+	ramp_shift = shift;
+	ramp_position = 0;
+}
+
+void profile_start(void)
+{
+	// Every move starts from the bottom of the ramp
+	ramp_position = 0;
+}
+
+uint16_t profile_next(uint16_t remaining)
+{
+	// It takes as many steps to slow down as it took to speed up,
+	//   if there are more steps left than that,
+	if (remaining > ramp_position)
+	{
+		// Keep accelerating until the top of the ramp
+		if (ramp_position < ramp_length)
+		{
+			ramp_position += 1;
+		}
+	}
+	// Otherwise, slow down so the last step is at start_rate
+	else if (ramp_position > 0)
+	{
+		ramp_position -= 1;
+	}
+
+	uint8_t index = ramp_position >> ramp_shift;
+	uint16_t fraction = ramp_position & ((1 << ramp_shift) - 1);
+	uint16_t period = table[index];
+
+	// Interpolate between table entries, the period only
+	//   gets shorter along the ramp
+	if (fraction != 0)
+	{
+		period -= ((uint32_t)(period - table[index + 1]) * fraction) >> ramp_shift;
+	}
+
+	// Period from this step to the next
+	return period;
+}
+
+uint16_t profile_ramp(void)
+{
+	// Steps it takes to slow down from the current rate
+	return ramp_position;
+}
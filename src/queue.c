@@ -0,0 +1,220 @@
+#include <stdint.h>
+
+#include "queue.h"
+#include "snapshot.h"
+
+// Number of segments, must be a power of 2
+#define QUEUE_SIZE 8
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+
+// Only the producer writes tail and only the consumer writes head
+//   Both are single bytes, so reads and writes are atomic and
+//   neither side has to disable interrupts
+static segment_t segments[QUEUE_SIZE];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+
+// Newest segment, only held back by the producer while the queue
+//   is full, more steps can be merged into it until there's room
+//   Everything else is published right away so the consumer can
+//   see every step coming when it plans the ramp
+static segment_t staged = {0};
+static uint8_t staged_valid = 0;
+
+static uint8_t high_water = 0;
+static uint16_t overflows = 0;
+static uint16_t merges = 0;
+
+static uint8_t publish(void)
+{
+	uint8_t t = tail;
+	uint8_t count = t - head;
+
+	// If the queue is full,
+	if (count >= QUEUE_SIZE)
+	{
+		// Keep holding the staged segment
+		return 0;
+	}
+
+	segments[t & QUEUE_MASK] = staged;
+	// The segment must be written before the consumer can see it
+	barrier();
+	tail = t + 1;
+
+	staged_valid = 0;
+
+	// Track the deepest the queue has been
+	count += 1;
+
+	if (count > high_water)
+	{
+		high_water = count;
+	}
+
+	return 1;
+}
+
+static uint8_t can_merge(int16_t steps, uint16_t period)
+{
+	// Only merge with a segment going the same way at the same rate
+	if (((steps < 0) != (staged.steps < 0)) || (period != staged.period))
+	{
+		return 0;
+	}
+
+	// ...and only if the sum still fits
+	if (steps > 0)
+	{
+		return staged.steps <= (INT16_MAX - steps);
+	}
+
+	return staged.steps >= (INT16_MIN - steps);
+}
+
+uint8_t queue_push(int16_t steps, uint16_t period)
+{
+	// If there is nothing to do,
+	if (steps == 0)
+	{
+		// Call it done
+		return 1;
+	}
+
+	if (staged_valid != 0)
+	{
+		// Grow the staged segment if possible
+		if (can_merge(steps, period) != 0)
+		{
+			staged.steps += steps;
+			merges += 1;
+
+			queue_flush();
+
+			return 1;
+		}
+
+		// Otherwise it has to go out before the new one
+		if (publish() == 0)
+		{
+			overflows += 1;
+
+			return 0;
+		}
+	}
+
+	staged.steps = steps;
+	staged.period = period;
+	staged_valid = 1;
+
+	queue_flush();
+
+	return 1;
+}
+
+void queue_flush(void)
+{
+	// Hand over the staged segment as soon as there is room
+	if (staged_valid != 0)
+	{
+		publish();
+	}
+}
+
+uint8_t queue_pending(void)
+{
+	// Published segments plus the staged one
+	return queue_count() + staged_valid;
+}
+
+uint8_t queue_pop(segment_t *segment)
+{
+	uint8_t h = head;
+
+	// If the queue is empty,
+	if (h == tail)
+	{
+		// Nothing to do here
+		return 0;
+	}
+
+	// Only read the segment after seeing it was published
+	barrier();
+	*segment = segments[h & QUEUE_MASK];
+	// The segment must be copied before the producer can reuse the slot
+	barrier();
+	head = h + 1;
+
+	return 1;
+}
+
+int16_t queue_peek(void)
+{
+	uint8_t h = head;
+
+	// If the queue is empty,
+	if (h == tail)
+	{
+		// No steps waiting
+		return 0;
+	}
+
+	barrier();
+
+	return segments[h & QUEUE_MASK].steps;
+}
+
+uint16_t queue_ahead(uint8_t negative, uint16_t needed)
+{
+	uint8_t h = head;
+	uint8_t t = tail;
+	uint16_t ahead = 0;
+
+	// Only read segments after seeing they were published
+	barrier();
+
+	// Add up the waiting segments going the same way, stopping
+	//   once there are as many steps as the caller needs
+	while ((h != t) && (ahead < needed))
+	{
+		int16_t steps = segments[h & QUEUE_MASK].steps;
+
+		if ((steps < 0) != (negative != 0))
+		{
+			break;
+		}
+
+		// Unsigned so -32768 doesn't overflow
+		uint16_t count = (steps < 0) ? (0 - (uint16_t)steps) : (uint16_t)steps;
+
+		if (count >= (needed - ahead))
+		{
+			return needed;
+		}
+
+		ahead += count;
+		h += 1;
+	}
+
+	return ahead;
+}
+
+uint8_t queue_count(void)
+{
+	return (uint8_t)(tail - head);
+}
+
+void queue_stats(queue_stats_t *stats)
+{
+	stats->high_water = high_water;
+	stats->overflows = overflows;
+	stats->merges = merges;
+}
+
+void queue_reset_stats(void)
+{
+	// Start the high water mark from what is waiting now
+	high_water = queue_count();
+	overflows = 0;
+	merges = 0;
+}
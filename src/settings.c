@@ -0,0 +1,295 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <avr/eeprom.h>
+
+#include "settings.h"
+#include "uart.h"
+
+// Marks the EEPROM as holding saved settings
+//   Bump SETTINGS_VERSION whenever settings_t changes, so old
+//   saved settings are ignored rather than read into the
+//   wrong fields
+#define SETTINGS_MAGIC 0x4743
+#define SETTINGS_VERSION 1
+
+typedef struct
+{
+	uint16_t magic;
+	uint8_t version;
+	uint8_t size;
+	settings_t settings;
+	// Sum of every byte before it
+	uint16_t checksum;
+} stored_t;
+
+// A setting, found by name and kept in settings_t at offset
+typedef struct
+{
+	const char *name;
+	uint8_t offset;
+	uint8_t size;
+	uint32_t min;
+	uint32_t max;
+} param_t;
+
+#define PARAM(name, field, min, max) \
+	{name, offsetof(settings_t, field), sizeof(((settings_t *)0)->field), min, max}
+
+// Times are in microseconds, rates in steps/s and increments
+//   in 0.0001"
+static const param_t params[] =
+{
+	PARAM("pulse", timing.pulse_us, 1, 10000),
+	PARAM("setup", timing.setup_us, 1, 10000),
+	// 0 disables the dwell
+	PARAM("dwell", timing.dwell_us, 0, 10000),
+	PARAM("group", timing.group, 1, UINT8_MAX),
+	PARAM("num", gear.numerator, 1, UINT16_MAX),
+	PARAM("den", gear.denominator, 1, UINT16_MAX),
+	// Start can't be above max, checked when they are applied
+	PARAM("start", profile.start_rate, 1, STEPPER_MAX_RATE),
+	PARAM("max", profile.max_rate, 1, STEPPER_MAX_RATE),
+	// 0 runs every move at the start rate
+	PARAM("accel", profile.accel, 0, 100000000),
+	PARAM("fine", increment_fine, 1, INT8_MAX),
+	PARAM("coarse", increment_coarse, 1, INT8_MAX),
+	PARAM("reverse", encoder_reverse, 0, 1),
+	PARAM("dirlow", direction_low, 0, 1),
+};
+
+#define PARAM_COUNT (sizeof(params) / sizeof(params[0]))
+
+static stored_t stored EEMEM;
+
+// Settings from the firmware, for settings_defaults()
+static settings_t defaults;
+// Settings as changed over the UART, applied by the
+//   main loop with settings_take() between moves
+static settings_t pending;
+static uint8_t changed = 0;
+static uint8_t dump_line = 0;
+// Copy being written out by settings_save_next(), and the
+//   next byte of it to write, 0 when no save is running
+static stored_t image;
+static uint8_t save_next = 0;
+
+static uint16_t get_checksum(const stored_t *s)
+{
+	const uint8_t *bytes = (const uint8_t *)s;
+	uint16_t sum = 0;
+
+	for (uint8_t i = 0; i < offsetof(stored_t, checksum); i++)
+	{
+		sum += bytes[i];
+	}
+
+	return sum;
+}
+
+static uint8_t is_valid(const settings_t *s)
+{
+	// Each setting is range checked on its own, this covers
+	//   the ones that depend on each other
+	//   The ramp can't start faster than it tops out
+	if (s->profile.start_rate > s->profile.max_rate)
+	{
+		return 0;
+	}
+
+	// One count can't make more steps than fit in a segment
+	return gear_is_valid(&s->gear);
+}
+
+static const param_t *get_param(const char *name)
+{
+	for (uint8_t i = 0; i < PARAM_COUNT; i++)
+	{
+		if (strcmp(name, params[i].name) == 0)
+		{
+			return &params[i];
+		}
+	}
+
+	return NULL;
+}
+
+static uint32_t get_value(const param_t *param)
+{
+	uint32_t value = 0;
+
+	// Both ends are little endian, a narrower field
+	//   lands in the low bytes
+	memcpy(&value, (const uint8_t *)&pending + param->offset, param->size);
+
+	return value;
+}
+
+uint8_t settings_init(settings_t *settings)
+{
+	stored_t s;
+	uint8_t loaded = 0;
+
+	defaults = *settings;
+
+	eeprom_read_block(&s, &stored, sizeof(s));
+
+	// If there are valid saved settings,
+	if ((s.magic == SETTINGS_MAGIC) && (s.version == SETTINGS_VERSION)
+		&& (s.size == sizeof(settings_t)) && (s.checksum == get_checksum(&s))
+		&& (is_valid(&s.settings) != 0))
+	{
+		// Start with them instead
+		*settings = s.settings;
+		loaded = 1;
+	}
+
+	pending = *settings;
+	changed = 0;
+
+	return loaded;
+}
+
+uint8_t settings_get(const char *name, uint32_t *value)
+{
+	const param_t *param = get_param(name);
+
+	if (param == NULL)
+	{
+		return 0;
+	}
+
+	*value = get_value(param);
+
+	return 1;
+}
+
+uint8_t settings_set(const char *name, uint32_t value)
+{
+	const param_t *param = get_param(name);
+
+	if ((param == NULL) || (value < param->min) || (value > param->max))
+	{
+		return 0;
+	}
+
+	memcpy((uint8_t *)&pending + param->offset, &value, param->size);
+	changed = 1;
+
+	return 1;
+}
+
+void settings_defaults(void)
+{
+	pending = defaults;
+	changed = 1;
+}
+
+uint8_t settings_pending(void)
+{
+	return changed;
+}
+
+uint8_t settings_take(settings_t *settings)
+{
+	// The change is used up either way, another set
+	//   command marks it changed again
+	changed = 0;
+
+	if (is_valid(&pending) == 0)
+	{
+		return 0;
+	}
+
+	*settings = pending;
+
+	return 1;
+}
+
+uint8_t settings_save(void)
+{
+	if (is_valid(&pending) == 0)
+	{
+		return 0;
+	}
+
+	image.magic = SETTINGS_MAGIC;
+	image.version = SETTINGS_VERSION;
+	image.size = sizeof(settings_t);
+	image.settings = pending;
+	image.checksum = get_checksum(&image);
+
+	// Start over from the first byte, settings_save_next()
+	//   writes it out in the background
+	save_next = 1;
+
+	return 1;
+}
+
+uint8_t settings_save_next(void)
+{
+	// If there is no save running or the last byte written
+	//   is still being programmed,
+	if ((save_next == 0) || (eeprom_is_ready() == 0))
+	{
+		// Nothing to do here
+		return 0;
+	}
+
+	const uint8_t *bytes = (const uint8_t *)&image;
+	uint8_t *dst = (uint8_t *)&stored;
+
+	// Skip bytes that already match, reading is quick
+	while (save_next <= sizeof(stored_t))
+	{
+		uint8_t i = save_next - 1;
+
+		save_next += 1;
+
+		// Write at most one byte per call, each one takes about
+		//   3.3ms to program and the EEPROM can only do one
+		//   at a time, so the main loop never waits on it
+		if (eeprom_read_byte(dst + i) != bytes[i])
+		{
+			eeprom_write_byte(dst + i, bytes[i]);
+
+			return 0;
+		}
+	}
+
+	// All done, the checksum went last
+	save_next = 0;
+
+	return 1;
+}
+
+void settings_dump_start(void)
+{
+	dump_line = 1;
+}
+
+void settings_dump_next(void)
+{
+	// If there is no dump running or the UART is still busy
+	//   with the last line,
+	if ((dump_line == 0) || (uart_tx_free() < UART_LINE_SIZE))
+	{
+		// Nothing to do here
+		return;
+	}
+
+	uint8_t line = dump_line - 1;
+
+	// All done
+	if (line >= PARAM_COUNT)
+	{
+		dump_line = 0;
+
+		return;
+	}
+
+	dump_line += 1;
+
+	printf("%s %lu\n", params[line].name, (unsigned long)get_value(&params[line]));
+}
@@ -1,10 +1,70 @@
 #include <stdint.h>
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 #include "gpio.h"
+#include "reg.h"
 #include "spi.h"
-#include "clock.h"
+#include "trace.h"
+#include "snapshot.h"
+
+#if SPI_BACKEND == SPI_HARDWARE
+
+// Size of the transmit buffer, must be a power of 2
+//   Each frame takes its length plus 2 header bytes,
+//   a full display update is 8 frames of 4 bytes
+#define BUFFER_SIZE 64
+#define BUFFER_MASK (BUFFER_SIZE - 1)
+
+// Frames are stored as chip select pin, length, then data
+//   Only spi_write() moves tail and only the ISR moves head
+static uint8_t buffer[BUFFER_SIZE];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+
+// Frame currently being sent
+static volatile uint8_t busy = 0;
+static gpio_t frame_cs;
+static uint8_t frame_left = 0;
+
+static void transfer_next(void)
+{
+	// If the current frame is done,
+	if (frame_left == 0)
+	{
+		// Release the chip select
+		if (busy != 0)
+		{
+			gpio_set_value(frame_cs, VAL_HIGH);
+		}
+
+		// If there are no more frames,
+		if (head == tail)
+		{
+			// Go idle until the next spi_write()
+			busy = 0;
+
+			return;
+		}
+
+		// Start the next frame
+		barrier();
+		frame_cs = (gpio_t)buffer[head & BUFFER_MASK];
+		frame_left = buffer[(head + 1) & BUFFER_MASK];
+		head += 2;
+
+		gpio_set_value(frame_cs, VAL_LOW);
+		busy = 1;
+	}
+
+	// Send the next byte, the interrupt fires when it is done
+	REG_WRITE(SPDR, buffer[head & BUFFER_MASK]);
+	head += 1;
+	frame_left -= 1;
+}
+
+#endif
 
 void spi_init(spi_t spi)
 {
@@ -12,34 +72,122 @@ void spi_init(spi_t spi)
 	gpio_direction(spi.cs, DIR_OUTPUT);
 	gpio_direction(spi.sck, DIR_OUTPUT);
 	gpio_direction(spi.mosi, DIR_OUTPUT);
+
+	#if SPI_BACKEND == SPI_HARDWARE
+		// SS must be an output or a low level on it
+		//   drops the peripheral out of master mode
+		gpio_direction(D10, DIR_OUTPUT);
+
+		// Enable SPI in master mode 0, MSB first, with the
+		//   transfer complete interrupt
+		// Clock prescale factor of 4 => 16MHz / 4 = 4MHz
+		SPCR = (1 << SPIE) | (1 << SPE) | (1 << MSTR);
+		SPSR = 0;
+	#endif
 }
 
 void spi_write(spi_t spi, uint8_t *data, uint8_t length)
 {
-	gpio_set_value(spi.cs, VAL_LOW);
+	TRACE_BEGIN(TRACE_SPI);
 
-	for (uint8_t i = 0; i < length; i++)
-	{
-		uint8_t val = data[i];
-
-		for (uint8_t j = 0; j < 8; j++)
+	#if SPI_BACKEND == SPI_HARDWARE
+		// If there is nothing to send, or the frame could never fit,
+		if ((length == 0) || (length > (BUFFER_SIZE - 2)))
 		{
-			gpio_value_t out = VAL_LOW;
+			// Nothing to do here
+			TRACE_END(TRACE_SPI);
+
+			return;
+		}
 
-			if ((val & 0x80) != 0)
+		// Wait for room for the header and data
+		while ((uint8_t)(BUFFER_SIZE - (uint8_t)(tail - head)) < (length + 2))
+		{
+			// If interrupts are disabled the ISR can't drain
+			//   the buffer, so poll for the end of each byte
+			if (((SREG & (1 << SREG_I)) == 0) && ((SPSR & (1 << SPIF)) != 0))
 			{
-				out = VAL_HIGH;
+				transfer_next();
 			}
+		}
 
-			gpio_set_value(spi.mosi, out);
-			val <<= 1;
+		uint8_t t = tail;
 
-			gpio_set_value(spi.sck, VAL_HIGH);
-			delay_us(10);
-			gpio_set_value(spi.sck, VAL_LOW);
-			delay_us(10);
+		buffer[t & BUFFER_MASK] = (uint8_t)spi.cs;
+		buffer[(t + 1) & BUFFER_MASK] = length;
+		t += 2;
+
+		for (uint8_t i = 0; i < length; i++)
+		{
+			buffer[t & BUFFER_MASK] = data[i];
+			t += 1;
 		}
-	}
 
-	gpio_set_value(spi.cs, VAL_HIGH);
+		// The frame must be written before the ISR can see it
+		barrier();
+		tail = t;
+
+		// Copy CPU flags
+		uint8_t sreg = SREG;
+		// Disable interrupts
+		cli();
+
+		// If the peripheral is idle, start sending
+		if (busy == 0)
+		{
+			transfer_next();
+		}
+
+		// Restore CPU flags
+		SREG = sreg;
+	#else
+		gpio_set_value(spi.cs, VAL_LOW);
+
+		for (uint8_t i = 0; i < length; i++)
+		{
+			uint8_t val = data[i];
+
+			for (uint8_t j = 0; j < 8; j++)
+			{
+				gpio_value_t out = VAL_LOW;
+
+				if ((val & 0x80) != 0)
+				{
+					out = VAL_HIGH;
+				}
+
+				gpio_set_value(spi.mosi, out);
+				val <<= 1;
+
+				// The clock runs as fast as the code toggles it,
+				//   each half period is at least one 62.5ns cycle
+				//   and the MAX7219 only needs 50ns high and low
+				gpio_set_value(spi.sck, VAL_HIGH);
+				gpio_set_value(spi.sck, VAL_LOW);
+			}
+		}
+
+		gpio_set_value(spi.cs, VAL_HIGH);
+	#endif
+
+	TRACE_END(TRACE_SPI);
+}
+
+uint8_t spi_busy(void)
+{
+	#if SPI_BACKEND == SPI_HARDWARE
+		return (busy != 0) || (head != tail);
+	#else
+		// Software SPI blocks until done
+		return 0;
+	#endif
+}
+
+#if SPI_BACKEND == SPI_HARDWARE
+// SPI Transfer Complete Interrupt
+ISR(SPI_STC_vect)
+{
+	// Send the next byte or frame
+	transfer_next();
 }
+#endif
@@ -0,0 +1,502 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "stepper.h"
+#include "profile.h"
+#include "queue.h"
+#include "gpio.h"
+#include "event.h"
+#include "clock.h"
+#include "trace.h"
+#include "snapshot.h"
+#include "reg.h"
+
+// Step output modes
+//   Software => ISR sets and clears the step pin, the step
+//     rate is limited by the ISR timing
+//   OC1A => Timer 1 toggles the step pin on each compare match,
+//     the ISR only counts pulses and the edges are jitter free
+//     Step output must be wired to D9 (OC1A)
+//   Can be picked from the build, make test runs both
+#define STEP_SOFTWARE 0
+#define STEP_OC1A 1
+#ifndef STEP_OUTPUT
+	#define STEP_OUTPUT STEP_SOFTWARE
+#endif
+
+#if STEP_OUTPUT == STEP_OC1A
+	#define STEP_OUT_PIN D9
+#else
+	#define STEP_OUT_PIN A0
+#endif
+#define DIR_OUT_PIN A1
+
+// Timer 1 is the free running clock timebase, each phase
+//   is scheduled by moving the compare value forward
+#define TICKS_PER_US CLOCK_TICKS_PER_US
+
+// Shortest interval the ISR can reliably schedule
+//   The timer keeps counting while the ISR runs, if the
+//   compare value is already behind the count the timer
+//   runs all the way around and the output stalls for ~32ms
+#define MIN_TICKS STEPPER_MIN_TICKS
+// Least time between reading the count and the next compare
+//   when the ISR is running late, reading TCNT1 to writing OCR1A
+//   is about 17 cycles, just over 2 ticks, and timer_next()
+//   checks afterwards in case that wasn't enough
+#define LATE_TICKS 3
+
+// Step generator phases, each one ends on a timer 1 compare
+#define PHASE_IDLE 0
+#define PHASE_SETUP 1
+#define PHASE_HIGH 2
+#define PHASE_LOW 3
+#define PHASE_TAIL 4
+
+static volatile uint8_t phase = PHASE_IDLE;
+static volatile uint16_t remaining = 0;
+// Every step pulse sent, free running
+static volatile uint16_t steps_sent = 0;
+// Shortest step period allowed by the current segment
+static uint16_t min_period = 0;
+static uint8_t group_count = 0;
+static gpio_value_t direction = VAL_LOW;
+
+// Length of each phase in timer counts
+static volatile uint16_t setup_ticks = 0;
+static volatile uint16_t pulse_ticks = 0;
+// Dwell time in timer counts
+static volatile uint16_t dwell_ticks = 0;
+static volatile uint8_t group = 1;
+
+static uint16_t get_ticks(uint32_t us)
+{
+	// Convert to timer counts
+	uint32_t ticks = us * TICKS_PER_US;
+
+	// Clamp to what the timer can schedule
+	if (ticks < MIN_TICKS)
+	{
+		ticks = MIN_TICKS;
+	}
+	else if (ticks > UINT16_MAX)
+	{
+		ticks = UINT16_MAX;
+	}
+
+	return (uint16_t)ticks;
+}
+
+static uint16_t magnitude(int16_t steps)
+{
+	// Unsigned so -32768 doesn't overflow
+	if (steps < 0)
+	{
+		return 0 - (uint16_t)steps;
+	}
+
+	return (uint16_t)steps;
+}
+
+static gpio_value_t get_level(int16_t steps)
+{
+	// Direction output is high for positive steps
+	if (steps < 0)
+	{
+		return VAL_LOW;
+	}
+
+	return VAL_HIGH;
+}
+
+static uint16_t get_low_ticks(void)
+{
+	uint16_t ahead = remaining;
+	uint16_t ramp = profile_ramp();
+
+	// If this segment is too short to hold the rate on its own,
+	//   count the waiting segments that carry on in the same
+	//   direction so the profile doesn't slow down between them
+	if (ahead <= ramp)
+	{
+		ahead += queue_ahead(direction == VAL_LOW, (ramp + 1) - ahead);
+	}
+
+	// Step period from the acceleration profile
+	uint16_t period = profile_next(ahead);
+	uint16_t high = pulse_ticks;
+
+	// Limit to the segment rate
+	if (period < min_period)
+	{
+		period = min_period;
+	}
+	uint16_t low = high;
+
+	// Stretch the low time to slow down to the profile rate,
+	//   never go below a 50% duty cycle
+	if ((period > high) && ((period - high) > high))
+	{
+		low = period - high;
+	}
+
+	// If this is the end of a group of pulses,
+	if (++group_count >= group)
+	{
+		// Add the dwell time to the low time
+		group_count = 0;
+
+		if (dwell_ticks > (UINT16_MAX - low))
+		{
+			low = UINT16_MAX;
+		}
+		else
+		{
+			low += dwell_ticks;
+		}
+	}
+
+	return low;
+}
+
+static void timer_start(uint16_t ticks)
+{
+	#if STEP_OUTPUT == STEP_OC1A
+		// Toggle OC1A on compare match, the first compare
+		//   is the rising edge of the first step pulse
+		TCCR1A = (1 << COM1A0);
+	#endif
+
+	// Schedule the first compare from the current count,
+	//   the timer itself keeps running for the clock
+	OCR1A = TCNT1 + ticks;
+	// Clear any stale compare flag
+	REG_WRITE(TIFR1, (1 << OCF1A));
+
+	// Enable timer 1 compare interrupt
+	TIMSK1 |= (1 << OCIE1A);
+}
+
+static void timer_next(uint16_t ticks)
+{
+	// Time since the compare that got us here
+	uint16_t last = OCR1A;
+	uint16_t late = TCNT1 - last;
+
+	// If the ISR ran so late the next compare would already be
+	//   behind the count, push it out instead of letting the
+	//   timer run all the way around
+	if (ticks < (late + LATE_TICKS))
+	{
+		ticks = late + LATE_TICKS;
+	}
+
+	// Count from the last compare so ISR latency doesn't add up
+	OCR1A = last + ticks;
+
+	// If the count got past the new compare before the write landed
+	//   there is no match until the timer comes all the way around,
+	//   so move it ahead of the count again
+	// Only past counts, on a match the flag is set by the time
+	//   the count moves on, and the ISR will run again for it
+	while (((uint16_t)(TCNT1 - last) > ticks) && ((TIFR1 & (1 << OCF1A)) == 0))
+	{
+		ticks = (uint16_t)(TCNT1 - last) + LATE_TICKS;
+		OCR1A = last + ticks;
+	}
+}
+
+static void timer_stop(void)
+{
+	// Disable timer 1 compare interrupt
+	TIMSK1 &= (uint8_t)~(1 << OCIE1A);
+}
+
+static uint8_t load_segment(void)
+{
+	segment_t segment;
+
+	// If there are no more segments,
+	if (queue_pop(&segment) == 0)
+	{
+		// Nothing to do here
+		return 0;
+	}
+
+	remaining = magnitude(segment.steps);
+	min_period = segment.period;
+	direction = get_level(segment.steps);
+
+	// There is room in the queue again
+	event_post(EVENT_STEPPER);
+
+	return 1;
+}
+
+static void start(void)
+{
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts, any ISR reading TCNT1 shares the
+	//   temporary byte the 16 bit timer writes go through
+	cli();
+
+	// If the step generator is idle and there is work queued,
+	if ((phase == PHASE_IDLE) && (load_segment() != 0))
+	{
+		// Set the direction output and give the driver
+		//   time to latch it in before the first step pulse
+		gpio_set_value(DIR_OUT_PIN, direction);
+		group_count = 0;
+		profile_start();
+
+		phase = PHASE_SETUP;
+		timer_start(setup_ticks);
+	}
+
+	// Restore CPU flags
+	SREG = sreg;
+}
+
+void stepper_init(const stepper_timing_t *timing)
+{
+	// Set step and direction outputs low before enabling them
+	gpio_set_value(STEP_OUT_PIN, VAL_LOW);
+	gpio_direction(STEP_OUT_PIN, DIR_OUTPUT);
+	gpio_set_value(DIR_OUT_PIN, VAL_LOW);
+	gpio_direction(DIR_OUT_PIN, DIR_OUTPUT);
+
+	stepper_set_timing(timing);
+
+	// Timer 1 is set up and started by clock_init(), leave
+	//   the compare interrupt off until there is work
+	TCCR1A = 0;
+	timer_stop();
+}
+
+void stepper_set_timing(const stepper_timing_t *timing)
+{
+	// Convert everything to timer counts up front so
+	//   the ISR only has to copy them
+	uint16_t setup = get_ticks(timing->setup_us);
+	uint16_t pulse = get_ticks(timing->pulse_us);
+	uint32_t dwell = (uint32_t)timing->dwell_us * TICKS_PER_US;
+	uint8_t size = timing->group;
+
+	// A group of 0 pulses would never dwell
+	if (size == 0)
+	{
+		size = 1;
+	}
+
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts, the ISR may be mid-move
+	cli();
+
+	setup_ticks = setup;
+	pulse_ticks = pulse;
+	dwell_ticks = (dwell > UINT16_MAX) ? UINT16_MAX : (uint16_t)dwell;
+	group = size;
+
+	// Restore CPU flags
+	SREG = sreg;
+}
+
+uint8_t stepper_move(uint16_t steps, gpio_value_t dir, uint32_t rate)
+{
+	uint16_t period = 0;
+
+	// Segments hold a signed 16 bit count
+	if (steps > INT16_MAX)
+	{
+		return 0;
+	}
+
+	// Convert the rate limit to a step period
+	if (rate != 0)
+	{
+		uint32_t ticks = PROFILE_TICK_HZ / rate;
+
+		period = (ticks > UINT16_MAX) ? UINT16_MAX : (uint16_t)ticks;
+	}
+
+	// Queue the steps, the step generator picks them up
+	//   when it is done with the segments before them
+	if (queue_push((dir == VAL_HIGH) ? (int16_t)steps : -(int16_t)steps, period) == 0)
+	{
+		return 0;
+	}
+
+	// Kick off the step generator if it is stopped
+	if (phase == PHASE_IDLE)
+	{
+		start();
+	}
+
+	return 1;
+}
+
+void stepper_update(void)
+{
+	// Hand over any steps held back for merging
+	queue_flush();
+
+	// Kick off the step generator if it is stopped
+	if (phase == PHASE_IDLE)
+	{
+		start();
+	}
+}
+
+uint16_t stepper_remaining(void)
+{
+	return snapshot16(&remaining);
+}
+
+uint16_t stepper_steps(void)
+{
+	return snapshot16(&steps_sent);
+}
+
+uint8_t stepper_busy(void)
+{
+	return (phase != PHASE_IDLE) || (queue_pending() != 0);
+}
+
+// Timer 1 Compare Interrupt
+ISR(TIMER1_COMPA_vect)
+{
+	TRACE_BEGIN(TRACE_TIMER1);
+
+	switch (phase)
+	{
+		case PHASE_TAIL:
+		{
+			// If the segment is complete,
+			if (remaining == 0)
+			{
+				gpio_value_t previous = direction;
+
+				// If there are no more segments,
+				if (load_segment() == 0)
+				{
+					// Stop here until the next move
+					timer_stop();
+					phase = PHASE_IDLE;
+					event_post(EVENT_STEPPER);
+
+					break;
+				}
+
+				// If the next segment changes direction,
+				if (direction != previous)
+				{
+					// Set the direction output and wait the setup
+					//   time, starting again from the bottom of the ramp
+					gpio_set_value(DIR_OUT_PIN, direction);
+					group_count = 0;
+					profile_start();
+
+					#if STEP_OUTPUT == STEP_OC1A
+						// Reconnect OC1A, the end of the setup time
+						//   is the rising edge of the first step pulse
+						TCCR1A = (1 << COM1A0);
+					#endif
+
+					timer_next(setup_ticks);
+					phase = PHASE_SETUP;
+
+					break;
+				}
+			}
+
+			// More steps in the same direction,
+			//   start the next pulse right away
+			#if STEP_OUTPUT == STEP_OC1A
+				// Reconnect OC1A and force the rising edge
+				TCCR1A = (1 << COM1A0);
+				REG_WRITE(TCCR1C, (1 << FOC1A));
+			#else
+				// Set step pin high
+				gpio_set_value(STEP_OUT_PIN, VAL_HIGH);
+			#endif
+
+			// Hold it for the pulse time
+			timer_next(pulse_ticks);
+			phase = PHASE_HIGH;
+
+			break;
+		}
+
+		case PHASE_SETUP:
+			// Fallthrough
+		case PHASE_LOW:
+		{
+			#if STEP_OUTPUT == STEP_SOFTWARE
+				// Set step pin high
+				gpio_set_value(STEP_OUT_PIN, VAL_HIGH);
+			#endif
+
+			// Hold it for the pulse time
+			timer_next(pulse_ticks);
+			phase = PHASE_HIGH;
+
+			break;
+		}
+
+		case PHASE_HIGH:
+		{
+			#if STEP_OUTPUT == STEP_SOFTWARE
+				// Set step pin low
+				gpio_set_value(STEP_OUT_PIN, VAL_LOW);
+			#endif
+
+			remaining -= 1;
+			steps_sent += 1;
+
+			// Hold it low until the next step is due
+			timer_next(get_low_ticks());
+
+			// If this was the last pulse of the segment but the
+			//   next one carries on in the same direction,
+			int16_t next = queue_peek();
+
+			if ((remaining == 0) && (next != 0) && (get_level(next) == direction))
+			{
+				// Run straight into it without a gap
+				load_segment();
+			}
+
+			// If this was the last pulse,
+			if (remaining == 0)
+			{
+				#if STEP_OUTPUT == STEP_OC1A
+					// Disconnect OC1A so the end of the low time
+					//   doesn't start another pulse
+					TCCR1A = 0;
+				#endif
+
+				phase = PHASE_TAIL;
+			}
+			else
+			{
+				phase = PHASE_LOW;
+			}
+
+			break;
+		}
+
+		default:
+		{
+			// Spurious compare, make sure the compare interrupt is off
+			timer_stop();
+			phase = PHASE_IDLE;
+
+			break;
+		}
+	}
+
+	TRACE_END(TRACE_TIMER1);
+}
@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "task.h"
+#include "clock.h"
+#include "uart.h"
+
+// Most tasks in the table
+#define TASK_MAX 8
+
+// Tasks only run from the main loop, nothing here is
+//   touched by an interrupt
+static const task_config_t *table = NULL;
+static uint8_t table_count = 0;
+static uint32_t deadline[TASK_MAX];
+static task_stats_t stats[TASK_MAX];
+static uint8_t dump_line = 0;
+// Longest task_run() call since task_pass_max() was last called
+static uint16_t pass_max_us = 0;
+
+void task_init(const task_config_t *tasks, uint8_t count)
+{
+	if (count > TASK_MAX)
+	{
+		count = TASK_MAX;
+	}
+
+	table = tasks;
+	table_count = count;
+
+	// Tasks run from the tick, so the earliest one can
+	//   run is on the next tick
+	uint32_t now = millis() + 1;
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		deadline[i] = now + tasks[i].phase_ms;
+	}
+
+	task_reset();
+}
+
+static int8_t get_due(uint32_t now)
+{
+	int8_t due = -1;
+
+	for (uint8_t i = 0; i < table_count; i++)
+	{
+		// Signed difference so deadlines can be on the
+		//   other side of the count wrapping around
+		if ((int32_t)(now - deadline[i]) < 0)
+		{
+			continue;
+		}
+
+		// Ties go to the task first in the table
+		if ((due < 0) || (table[i].priority < table[due].priority))
+		{
+			due = i;
+		}
+	}
+
+	return due;
+}
+
+void task_run(void)
+{
+	uint32_t pass = micros();
+
+	while (1)
+	{
+		uint32_t now = millis();
+		int8_t i = get_due(now);
+
+		// If nothing is due,
+		if (i < 0)
+		{
+			break;
+		}
+
+		const task_config_t *task = &table[i];
+		task_stats_t *s = &stats[i];
+		uint32_t late = now - deadline[i];
+
+		if (late > s->latency_max_ms)
+		{
+			s->latency_max_ms = (late > UINT16_MAX) ? UINT16_MAX : (uint16_t)late;
+		}
+
+		// Next deadline is a whole number of periods from the
+		//   first, if the task fell a period or more behind, the
+		//   deadlines it missed are skipped rather than run back
+		//   to back to catch up
+		uint32_t skipped = late / task->period_ms;
+
+		s->missed += (uint16_t)skipped;
+		deadline[i] += (skipped + 1) * task->period_ms;
+
+		uint32_t start = micros();
+
+		task->handler();
+
+		uint32_t run = micros() - start;
+
+		s->runs += 1;
+		s->run_total_us += run;
+
+		if (run > s->run_max_us)
+		{
+			s->run_max_us = (run > UINT16_MAX) ? UINT16_MAX : (uint16_t)run;
+		}
+	}
+
+	pass = micros() - pass;
+
+	if (pass > pass_max_us)
+	{
+		pass_max_us = (pass > UINT16_MAX) ? UINT16_MAX : (uint16_t)pass;
+	}
+}
+
+uint16_t task_pass_max(void)
+{
+	uint16_t max = pass_max_us;
+
+	pass_max_us = 0;
+
+	return max;
+}
+
+void task_get_stats(uint8_t index, task_stats_t *s)
+{
+	if (index < table_count)
+	{
+		*s = stats[index];
+	}
+}
+
+void task_reset(void)
+{
+	for (uint8_t i = 0; i < TASK_MAX; i++)
+	{
+		stats[i].runs = 0;
+		stats[i].missed = 0;
+		stats[i].latency_max_ms = 0;
+		stats[i].run_max_us = 0;
+		stats[i].run_total_us = 0;
+	}
+}
+
+void task_dump_start(void)
+{
+	dump_line = 1;
+}
+
+void task_dump_next(void)
+{
+	// If there is no dump running or the UART is still busy
+	//   with the last line,
+	if ((dump_line == 0) || (uart_tx_free() < UART_LINE_SIZE))
+	{
+		// Nothing to do here
+		return;
+	}
+
+	uint8_t line = dump_line - 1;
+
+	dump_line += 1;
+
+	// Header, latency is in milliseconds and run times
+	//   are in microseconds
+	if (line == 0)
+	{
+		printf("tasks: name runs missed late avg max\n");
+
+		return;
+	}
+
+	line -= 1;
+
+	// One line of stats for every task
+	if (line < table_count)
+	{
+		task_stats_t *s = &stats[line];
+		uint32_t avg = (s->runs != 0) ? (s->run_total_us / s->runs) : 0;
+
+		printf("%s %u %u %u %lu %u\n", table[line].name, s->runs, s->missed,
+			s->latency_max_ms, (unsigned long)avg, s->run_max_us);
+
+		return;
+	}
+
+	// All done
+	dump_line = 0;
+}
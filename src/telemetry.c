@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "telemetry.h"
+#include "clock.h"
+#include "encoder.h"
+#include "stepper.h"
+#include "queue.h"
+#include "task.h"
+#include "uart.h"
+
+#if TELEMETRY_ENABLE != 0
+
+// Sample and CRC, before COBS encoding
+#define PAYLOAD_SIZE (sizeof(telemetry_sample_t) + TELEMETRY_CRC_SIZE)
+
+static union
+{
+	telemetry_sample_t sample;
+	uint8_t bytes[PAYLOAD_SIZE];
+} payload;
+
+// The frame is built here and handed to the UART in one piece
+static uint8_t frame[TELEMETRY_FRAME_SIZE];
+
+static uint8_t sequence = 0;
+static uint16_t dropped = 0;
+// Counters as of the last sample, for the deltas
+static uint32_t last_time = 0;
+static uint16_t last_count = 0;
+static uint16_t last_steps = 0;
+
+static uint8_t encode(const uint8_t *in, uint8_t length, uint8_t *out)
+{
+	// COBS, each zero is replaced by the distance to the next,
+	//   the first byte is the distance to the first zero
+	//   Frames are well under 254 bytes, so no run is split
+	uint8_t code_index = 0;
+	uint8_t code = 1;
+	uint8_t n = 1;
+
+	for (uint8_t i = 0; i < length; i++)
+	{
+		if (in[i] == 0)
+		{
+			out[code_index] = code;
+			code_index = n;
+			code = 1;
+		}
+		else
+		{
+			out[n] = in[i];
+			code += 1;
+		}
+
+		n += 1;
+	}
+
+	out[code_index] = code;
+
+	return n;
+}
+
+void telemetry_init(void)
+{
+	sequence = 0;
+	dropped = 0;
+	last_time = micros();
+	last_count = encoder_count();
+	last_steps = stepper_steps();
+}
+
+void telemetry_send(int32_t position)
+{
+	telemetry_sample_t *s = &payload.sample;
+	uint32_t now = micros();
+	uint16_t count = encoder_count();
+	uint16_t steps = stepper_steps();
+	uint32_t elapsed = now - last_time;
+	uint32_t rate = 0;
+
+	if (elapsed != 0)
+	{
+		rate = ((uint32_t)(uint16_t)(steps - last_steps) * 1000000UL) / elapsed;
+	}
+
+	s->version = TELEMETRY_VERSION;
+	s->sequence = sequence;
+	s->time_us = now;
+	s->position = position;
+	s->encoder_delta = (int16_t)(count - last_count);
+	s->queue_depth = queue_count();
+	s->step_rate = (rate > UINT16_MAX) ? UINT16_MAX : (uint16_t)rate;
+	s->loop_max_us = task_pass_max();
+	s->dropped = dropped;
+
+	last_time = now;
+	last_count = count;
+	last_steps = steps;
+	sequence += 1;
+
+	uint16_t crc = telemetry_crc(0xFFFF, payload.bytes, sizeof(telemetry_sample_t));
+
+	payload.bytes[sizeof(telemetry_sample_t)] = crc & 0xFF;
+	payload.bytes[sizeof(telemetry_sample_t) + 1] = crc >> 8;
+
+	frame[0] = 0;
+	uint8_t length = encode(payload.bytes, PAYLOAD_SIZE, frame + 1) + 1;
+	frame[length] = 0;
+	length += 1;
+
+	// If the UART is still busy with the last frame or text,
+	if (uart_write(frame, length) == 0)
+	{
+		// Drop this one, the gap in the sequence shows it
+		dropped += 1;
+	}
+}
+
+#endif
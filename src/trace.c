@@ -0,0 +1,256 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "trace.h"
+#include "uart.h"
+#include "gpio.h"
+
+#if TRACE_ENABLE != 0
+
+#if TRACE_OUTPUT == TRACE_RAM
+
+// Number of recent calls kept, must be a power of 2
+#define RING_SIZE 32
+#define RING_MASK (RING_SIZE - 1)
+
+// Timer 1 counts are 8 CPU cycles
+#define CYCLES_PER_TICK 8
+
+typedef struct
+{
+	uint16_t count;
+	uint16_t min;
+	uint16_t max;
+	uint32_t total;
+	// Main loop trace points only, an interrupt ran in the middle
+	uint16_t interrupted;
+} trace_stats_t;
+
+typedef struct
+{
+	uint8_t point;
+	uint16_t start;
+	uint16_t length;
+} trace_record_t;
+
+static const char *const names[TRACE_COUNT] =
+{
+	"INT0",
+	"INT1",
+	"TIMER0",
+	"TIMER1",
+	"TIMER2",
+	"handle_output",
+	"display_update",
+	"spi_write",
+};
+
+volatile uint8_t trace_isr_count = 0;
+
+static trace_stats_t stats[TRACE_COUNT];
+static trace_record_t ring[RING_SIZE];
+static uint8_t ring_next = 0;
+static uint8_t ring_count = 0;
+
+// Stats are copied when a dump starts and the ring is held
+//   still until it is done, so the dump is consistent
+static trace_stats_t dump_stats[TRACE_COUNT];
+static volatile uint8_t dumping = 0;
+static uint8_t dump_line = 0;
+
+void trace_init(void)
+{
+	trace_reset();
+}
+
+void trace_end(trace_point_t point, trace_mark_t mark)
+{
+	uint16_t length = TCNT1 - mark.start;
+
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts, interrupts record too
+	cli();
+
+	trace_stats_t *s = &stats[point];
+
+	// Stop counting rather than wrap, so the average holds
+	if (s->count != UINT16_MAX)
+	{
+		s->count += 1;
+		s->total += length;
+	}
+
+	if (length < s->min)
+	{
+		s->min = length;
+	}
+
+	if (length > s->max)
+	{
+		s->max = length;
+	}
+
+	if (point < TRACE_ISR_COUNT)
+	{
+		trace_isr_count += 1;
+	}
+	// If an interrupt finished since this trace point started,
+	else if (trace_isr_count != mark.isr_count)
+	{
+		// Its time is part of the length
+		s->interrupted += 1;
+	}
+
+	if (dumping == 0)
+	{
+		ring[ring_next].point = point;
+		ring[ring_next].start = mark.start;
+		ring[ring_next].length = length;
+		ring_next = (ring_next + 1) & RING_MASK;
+
+		if (ring_count < RING_SIZE)
+		{
+			ring_count += 1;
+		}
+	}
+
+	// Restore CPU flags
+	SREG = sreg;
+}
+
+void trace_reset(void)
+{
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts
+	cli();
+
+	for (uint8_t i = 0; i < TRACE_COUNT; i++)
+	{
+		stats[i].count = 0;
+		stats[i].min = UINT16_MAX;
+		stats[i].max = 0;
+		stats[i].total = 0;
+		stats[i].interrupted = 0;
+	}
+
+	ring_next = 0;
+	ring_count = 0;
+
+	// Restore CPU flags
+	SREG = sreg;
+}
+
+void trace_dump_start(void)
+{
+	// Copy CPU flags
+	uint8_t sreg = SREG;
+	// Disable interrupts
+	cli();
+
+	for (uint8_t i = 0; i < TRACE_COUNT; i++)
+	{
+		dump_stats[i] = stats[i];
+	}
+
+	dumping = 1;
+
+	// Restore CPU flags
+	SREG = sreg;
+
+	dump_line = 1;
+}
+
+void trace_dump_next(void)
+{
+	// If there is no dump running or the UART is still busy
+	//   with the last line,
+	if ((dump_line == 0) || (uart_tx_free() < UART_LINE_SIZE))
+	{
+		// Nothing to do here
+		return;
+	}
+
+	uint8_t line = dump_line - 1;
+
+	dump_line += 1;
+
+	// Header, times are in CPU cycles
+	if (line == 0)
+	{
+		printf("trace: point count min avg max interrupted\n");
+
+		return;
+	}
+
+	line -= 1;
+
+	// One line of stats for every trace point
+	if (line < TRACE_COUNT)
+	{
+		trace_stats_t *s = &dump_stats[line];
+
+		if (s->count == 0)
+		{
+			printf("%s 0\n", names[line]);
+
+			return;
+		}
+
+		printf("%s %u %lu %lu %lu %u\n", names[line], s->count,
+			(unsigned long)s->min * CYCLES_PER_TICK,
+			((unsigned long)s->total * CYCLES_PER_TICK) / s->count,
+			(unsigned long)s->max * CYCLES_PER_TICK,
+			s->interrupted);
+
+		return;
+	}
+
+	line -= TRACE_COUNT;
+
+	if (line == 0)
+	{
+		printf("recent: point start length\n");
+
+		return;
+	}
+
+	line -= 1;
+
+	// Then the ring buffer, oldest first
+	if (line < ring_count)
+	{
+		trace_record_t *r = &ring[(ring_next - ring_count + line) & RING_MASK];
+
+		printf("%s %u %lu\n", names[r->point], r->start,
+			(unsigned long)r->length * CYCLES_PER_TICK);
+
+		return;
+	}
+
+	// All done, start recording calls again
+	dumping = 0;
+	dump_line = 0;
+}
+
+#else
+
+void trace_init(void)
+{
+	// Debug pins start low
+	for (uint8_t i = 0; i < TRACE_COUNT; i++)
+	{
+		if (trace_pins[i] != TRACE_NO_PIN)
+		{
+			gpio_set_value((gpio_t)trace_pins[i], VAL_LOW);
+			gpio_direction((gpio_t)trace_pins[i], DIR_OUTPUT);
+		}
+	}
+}
+
+#endif
+
+#endif
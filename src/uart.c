@@ -3,37 +3,201 @@
 #include <avr/interrupt.h>
 
 #include "uart.h"
+#include "reg.h"
+#include "snapshot.h"
 
-static int uart_putchar(char c, FILE *stream)
+// Size of the transmit buffer, must be a power of 2
+#define TX_BUFFER_SIZE 64
+#define TX_BUFFER_MASK (TX_BUFFER_SIZE - 1)
+
+// Size of the receive buffer, must be a power of 2
+//   Holds a full command line while the main loop is busy
+#define RX_BUFFER_SIZE 32
+#define RX_BUFFER_MASK (RX_BUFFER_SIZE - 1)
+
+// What to do with a character when the transmit buffer is full
+//   Drop => Throw the character away and count it
+//   Block => Wait for room, stalls the caller
+#define TX_DROP 0
+#define TX_BLOCK 1
+#define TX_POLICY TX_DROP
+
+// Only uart_putchar() moves tail and only the ISR moves head
+static uint8_t tx_buffer[TX_BUFFER_SIZE];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+static volatile uint16_t tx_dropped = 0;
+
+// Only the ISR moves tail and only uart_read() moves head
+static uint8_t rx_buffer[RX_BUFFER_SIZE];
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+static volatile uint16_t rx_dropped = 0;
+
+static void tx_next(void)
 {
-	(void)stream;
+	uint8_t h = tx_head;
+
+	// If there is nothing left to send,
+	if (h == tx_tail)
+	{
+		// Disable data register empty interrupt
+		UCSR0B &= ~(1 << UDRIE0);
+
+		return;
+	}
 
-	// Wait until transmit buffer is empty
-	while ((UCSR0A & (1 << UDRE0)) == 0);
 	// Transmit character
-	UDR0 = c;
+	barrier();
+	REG_WRITE(UDR0, tx_buffer[h & TX_BUFFER_MASK]);
+	tx_head = h + 1;
+}
+
+int uart_putchar(char c, FILE *stream)
+{
+	(void)stream;
+
+	uint8_t t = tx_tail;
+
+	// While the transmit buffer is full,
+	while ((uint8_t)(t - tx_head) >= TX_BUFFER_SIZE)
+	{
+		#if TX_POLICY == TX_BLOCK
+			// If interrupts are disabled the ISR can't drain
+			//   the buffer, so send by polling instead
+			if (((SREG & (1 << SREG_I)) == 0) && ((UCSR0A & (1 << UDRE0)) != 0))
+			{
+				tx_next();
+			}
+		#else
+			// Throw the character away
+			tx_dropped += 1;
+
+			return 0;
+		#endif
+	}
+
+	tx_buffer[t & TX_BUFFER_MASK] = c;
+	// The character must be written before the ISR can see it
+	barrier();
+	tx_tail = t + 1;
+
+	// Enable data register empty interrupt to start sending
+	UCSR0B |= (1 << UDRIE0);
 
 	return 0;
 }
 
-static FILE uart_str = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_RW);
-
 void uart_init(uint32_t baud)
 {
 	// Enable double transmit speed
 	UCSR0A = 1 << U2X0;
 
-	// Write baud rate setting
-	uint16_t baud_setting = (F_CPU / (8 * baud)) - 1;
+	// Write baud rate setting, rounded to the nearest divider
+	//   16MHz with U2X gives exact rates for 250k, 500k and 1M
+	uint16_t baud_setting = ((F_CPU / 4 / baud) - 1) / 2;
 	UBRR0H = (uint8_t)((baud_setting & 0xFF00) >> 8);
 	UBRR0L = (uint8_t)(baud_setting & 0x00FF);
 
 	// Configure N81
 	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
 
-	// Enable RX and TX
-	UCSR0B |= (1 << RXEN0) | (1 << TXEN0);
+	// Enable RX, RX complete interrupt and TX
+	UCSR0B |= (1 << RXEN0) | (1 << RXCIE0) | (1 << TXEN0);
 
 	// Set STDOUT to use the uart
-	stdout = &uart_str;
+	uart_stdout_init();
+}
+
+uint16_t uart_tx_dropped(void)
+{
+	return snapshot16(&tx_dropped);
+}
+
+uint16_t uart_rx_dropped(void)
+{
+	return snapshot16(&rx_dropped);
+}
+
+uint8_t uart_tx_free(void)
+{
+	// Only the ISR moves head, a stale value only
+	//   undercounts the free space
+	return TX_BUFFER_SIZE - (uint8_t)(tx_tail - tx_head);
+}
+
+uint8_t uart_write(const uint8_t *data, uint8_t length)
+{
+	uint8_t t = tx_tail;
+
+	// If it doesn't all fit, send none of it, so a binary
+	//   frame never goes out cut short
+	if ((uint8_t)(TX_BUFFER_SIZE - (uint8_t)(t - tx_head)) < length)
+	{
+		return 0;
+	}
+
+	for (uint8_t i = 0; i < length; i++)
+	{
+		tx_buffer[(uint8_t)(t + i) & TX_BUFFER_MASK] = data[i];
+	}
+
+	// The data must be written before the ISR can see it
+	barrier();
+	tx_tail = t + length;
+
+	// Enable data register empty interrupt to start sending
+	UCSR0B |= (1 << UDRIE0);
+
+	return 1;
+}
+
+int16_t uart_read(void)
+{
+	uint8_t h = rx_head;
+
+	// If no character has been received,
+	if (h == rx_tail)
+	{
+		// Nothing to do here
+		return -1;
+	}
+
+	// Only read the character after seeing it was queued
+	barrier();
+	uint8_t c = rx_buffer[h & RX_BUFFER_MASK];
+	// The character must be copied before the ISR can reuse the slot
+	barrier();
+	rx_head = h + 1;
+
+	return c;
+}
+
+// USART Receive Complete Interrupt
+ISR(USART_RX_vect)
+{
+	// Reading the data register clears the interrupt
+	uint8_t c = UDR0;
+	uint8_t t = rx_tail;
+
+	// If the reader has fallen behind,
+	if ((uint8_t)(t - rx_head) >= RX_BUFFER_SIZE)
+	{
+		// Drop the character
+		rx_dropped += 1;
+
+		return;
+	}
+
+	rx_buffer[t & RX_BUFFER_MASK] = c;
+	// The character must be written before the reader can see it
+	barrier();
+	rx_tail = t + 1;
+}
+
+// USART Data Register Empty Interrupt
+ISR(USART_UDRE_vect)
+{
+	// Send the next character
+	tx_next();
 }
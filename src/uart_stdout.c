@@ -0,0 +1,10 @@
+#include <stdio.h>
+
+#include "uart.h"
+
+static FILE uart_str = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
+
+void uart_stdout_init(void)
+{
+	stdout = &uart_str;
+}
@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+
+// Checks format_position() against the snprintf() formatting it
+//   replaced, for every value the display can show in full and
+//   the ones past it, the int32_t edges and both sides of every
+//   power of 10
+//   Exits non-zero on any mismatch
+
+// Largest magnitude with all its digits on the display
+#define DISPLAY_MAX 9999999L
+// Mismatches printed before the rest are only counted
+#define SHOW_MAX 10
+
+static uint32_t failures = 0;
+static uint32_t checked = 0;
+
+static void reference(int32_t value, char *digits)
+{
+	// The old display code, the magnitude is 64 bits so
+	//   INT32_MIN doesn't overflow when negated
+	char text[16];
+	char prefix = (value < 0) ? '-' : ' ';
+	long long magnitude = llabs((long long)value);
+
+	if (magnitude < 10000)
+	{
+		snprintf(text, sizeof(text), "%c  0%04lld", prefix, magnitude);
+	}
+	else
+	{
+		snprintf(text, sizeof(text), "%c%7lld", prefix, magnitude);
+	}
+
+	// It printed into 9 bytes, so only the first 8 characters
+	//   made it, keeping the 7 most significant digits
+	memcpy(digits, text, 8);
+}
+
+static void check(int32_t value)
+{
+	char expected[8];
+	char actual[8];
+
+	reference(value, expected);
+	format_position(value, actual);
+	checked += 1;
+
+	if (memcmp(expected, actual, 8) == 0)
+	{
+		return;
+	}
+
+	if (failures < SHOW_MAX)
+	{
+		printf("FAIL: %ld => \"%.8s\", expected \"%.8s\"\n", (long)value, actual, expected);
+	}
+
+	failures += 1;
+}
+
+int main(void)
+{
+	check(0);
+	check(INT32_MIN);
+	check(INT32_MIN + 1);
+	check(INT32_MAX);
+	check(INT32_MAX - 1);
+
+	// Either side of every power of 10, both signs
+	int64_t power = 1;
+
+	for (uint8_t i = 0; i < 10; i++)
+	{
+		for (int64_t offset = -1; offset <= 1; offset++)
+		{
+			int64_t value = power + offset;
+
+			if (value <= INT32_MAX)
+			{
+				check((int32_t)value);
+				check((int32_t)-value);
+			}
+		}
+
+		power *= 10;
+	}
+
+	// Every value the display can show in full
+	for (int32_t value = -DISPLAY_MAX; value <= DISPLAY_MAX; value++)
+	{
+		check(value);
+	}
+
+	printf("format: %u values, %u failed\n", checked, failures);
+
+	return (failures == 0) ? 0 : 1;
+}
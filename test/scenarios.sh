@@ -0,0 +1,71 @@
+#!/bin/sh
+# Scripted runs of the host build, each one turns the encoder,
+#   presses buttons or sends commands and checks the step output
+#   and the display at the end, see the -e option in host/main.c
+#   Exits non-zero if any scenario fails
+#   scenarios.sh [path to the host build] [step output pin]
+#   The step pin is A0, or D9 for a build with STEP_OC1A
+
+sim=${1:-build/host/grinder_controller}
+pin=${2:-A0}
+log=${TMPDIR:-/tmp}/scenario.$$
+failed=0
+
+run()
+{
+	name=$1
+	shift
+
+	if "$sim" -S "$pin" "$@" > /dev/null 2> "$log"
+	then
+		echo "pass: $name"
+	else
+		echo "FAIL: $name"
+		sed 's/^/  /' "$log"
+		failed=1
+	fi
+}
+
+# Slow turns stay on the fine increment, 0.0001" per detent
+#   and 4 steps per 0.0001" with the default gearing
+run "slow turn up" -n 10 -r 5 \
+	-e steps=40 -e high=40 -e low=0 -e display="   0.0010"
+run "slow turn down" -n -10 -r 5 \
+	-e steps=40 -e high=0 -e low=40 -e display="-  0.0010"
+
+# Fast spins on the fine increment, every step still has to
+#   go out promptly and in the same direction
+run "fast spin" -n 200 -r 400 -s 400 -p D6@100 \
+	-e steps=800 -e low=0 -e display="   0.0200" -e latency=20
+
+# Fast spins without pressing anything stay fine too
+run "fast spin from reset" -n 200 -r 400 \
+	-e steps=800 -e low=0 -e display="   0.0200"
+
+# Holding FINE turns on adaptive gain, the increments depend on
+#   the detent timing the firmware sees, whatever they were the
+#   steps have to match the display
+run "adaptive spin" -n 200 -r 400 -s 1500 -p D6@100:1200 \
+	-e ratio=4 -e low=0 -e latency=20
+
+# Coarse button before turning, 0.0010" per detent
+run "coarse button" -n 10 -r 5 -s 400 -p D5@100 \
+	-e steps=400 -e high=400 -e display="   0.0100"
+
+# Zero button after turning clears the display without
+#   driving the table back
+run "zero button" -n 10 -r 5 -p D4@2300 -t 3000 \
+	-e steps=40 -e low=0 -e display="   0.0000"
+
+# Settings changed over the UART apply to the next move
+run "gear over uart" -n 10 -r 5 -s 400 -u '100:set num 2\n' \
+	-e steps=20 -e high=20 -e display="   0.0010"
+
+# A ratio where one count doesn't fit in a step segment is
+#   rejected and the old gearing stays in use
+run "bad gear over uart" -n 10 -r 5 -s 400 -u '100:set num 40000\n' \
+	-e steps=40 -e high=40 -e display="   0.0010"
+
+rm -f "$log"
+
+exit $failed